@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "structs.h"
+#include "batch.h"
+#include "collect.h"
+#include "proc.h"
+#include "machine.h"
+#include "util.h"
+#include "main.h"
+
+/* Without the gui: the collector's snapshots go to stdout as they come.
+ * Records are formatted straight into one buffer, which is written out
+ * when it fills and at the end of each snapshot.
+ *
+ * For changed-only output, each record (less its time) is hashed and
+ * kept by pid and starttime. A record is only written if its hash is
+ * new, and processes missing from the next snapshot are written as
+ * exited.
+ */
+
+#define OUT_FLUSH (64 * 1024)
+
+static char *out;
+static size_t out_len, out_max;
+
+struct seen
+{
+	pid_t pid; /* 0: empty */
+	unsigned long long starttime, hash;
+};
+
+/* open-addressed, rebuilt each snapshot - last and this */
+static struct seen *seen, *seen_next;
+static size_t nseen, nseen_next; /* slots, a power of two */
+
+static void out_flush(void)
+{
+	size_t done = 0;
+
+	while(done < out_len){
+		const ssize_t n = write(STDOUT_FILENO, out + done, out_len - done);
+
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			perror("write()");
+			exit(1);
+		}
+		done += n;
+	}
+	out_len = 0;
+}
+
+static void out_reserve(size_t n)
+{
+	if(out_len + n > out_max){
+		out_max = (out_len + n) * 2;
+		out = urealloc(out, out_max);
+	}
+}
+
+static void out_add(const char *s, size_t n)
+{
+	out_reserve(n);
+	memcpy(out + out_len, s, n);
+	out_len += n;
+}
+
+static void out_str(const char *s)
+{
+	out_add(s, strlen(s));
+}
+
+static void out_fmt(const char *fmt, ...)
+{
+	va_list l;
+	int n;
+
+	out_reserve(128);
+
+	va_start(l, fmt);
+	n = vsnprintf(out + out_len, out_max - out_len, fmt, l);
+	va_end(l);
+
+	if(n < 0)
+		return;
+
+	if(out_len + n >= out_max){
+		out_reserve(n + 1);
+
+		va_start(l, fmt);
+		vsnprintf(out + out_len, out_max - out_len, fmt, l);
+		va_end(l);
+	}
+	out_len += n;
+}
+
+/* one line per process - no newlines or other controls */
+static void out_text(const char *s)
+{
+	for(; *s; s++)
+		out_add((unsigned char)*s < 0x20 ? "?" : s, 1);
+}
+
+static void out_csv(const char *s)
+{
+	if(!strpbrk(s, ",\"\r\n")){
+		out_str(s);
+		return;
+	}
+
+	out_add("\"", 1);
+	for(; *s; s++){
+		if(*s == '"')
+			out_add("\"", 1);
+		out_add(s, 1);
+	}
+	out_add("\"", 1);
+}
+
+static void out_json(const char *s)
+{
+	out_add("\"", 1);
+	for(; *s; s++){
+		const unsigned char c = *s;
+
+		if(c == '"' || c == '\\'){
+			out_add("\\", 1);
+			out_add(s, 1);
+		}else if(c < 0x20){
+			out_fmt("\\u%04x", c);
+		}else{
+			out_add(s, 1);
+		}
+	}
+	out_add("\"", 1);
+}
+
+static unsigned long long hash(const char *p, size_t n)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	while(n--)
+		h = (h ^ (unsigned char)*p++) * 1099511628211ULL;
+
+	return h | 1; /* never 0 */
+}
+
+static struct seen *seen_find(struct seen *tbl, size_t n, pid_t pid)
+{
+	size_t i;
+
+	for(i = pid & (n - 1); tbl[i].pid && tbl[i].pid != pid; i = (i + 1) & (n - 1));
+
+	return &tbl[i];
+}
+
+/* the start of the next snapshot's table, with room for count */
+static void seen_begin(size_t count)
+{
+	size_t n = 64;
+
+	while(n < count * 2)
+		n *= 2;
+
+	if(n != nseen_next){
+		free(seen_next);
+		seen_next = umalloc(n * sizeof *seen_next);
+		nseen_next = n;
+	}
+	memset(seen_next, 0, n * sizeof *seen_next);
+}
+
+/* 1 if p's record hashes the same as last snapshot */
+static int seen_same(struct myproc *p, unsigned long long h)
+{
+	struct seen *s = seen_find(seen_next, nseen_next, p->pid);
+	struct seen *last;
+
+	s->pid = p->pid;
+	s->starttime = p->starttime;
+	s->hash = h;
+
+	if(!seen)
+		return 0;
+
+	last = seen_find(seen, nseen, p->pid);
+	return last->pid == p->pid && last->starttime == p->starttime && last->hash == h;
+}
+
+static void seen_end(void)
+{
+	struct seen *tmp = seen;
+	const size_t ntmp = nseen;
+
+	seen = seen_next;
+	nseen = nseen_next;
+	seen_next = tmp;
+	nseen_next = ntmp;
+}
+
+static const char *user(struct myproc *p)
+{
+	static char buf[16];
+
+	if(p->unam)
+		return p->unam;
+	snprintf(buf, sizeof buf, "%d", (int)p->uid);
+	return buf;
+}
+
+/* the part of a record that isn't compared for changes */
+static void batch_time(enum batch_format fmt, long long now_ms)
+{
+	switch(fmt){
+		case BATCH_TEXT:
+			break;
+		case BATCH_CSV:
+			out_fmt("%lld,", now_ms);
+			break;
+		case BATCH_JSON:
+			out_fmt("{\"time\":%lld,", now_ms);
+			break;
+	}
+}
+
+static void batch_proc(struct myproc *p, enum batch_format fmt)
+{
+	const char *const cmd = p->shell_cmd ? p->shell_cmd : p->comm;
+
+	switch(fmt){
+		case BATCH_TEXT:
+			out_fmt("% 11d %s%*s", p->pid, machine_proc_display_line(p),
+					p->depth * 2 + 1, "");
+			out_text(cmd);
+			out_add("\n", 1);
+			break;
+
+		case BATCH_CSV:
+			out_fmt("%d,%d,%s,%s,%d,%.1f,%lu,%lu,",
+					p->pid, p->ppid, user(p), proc_state_str(p),
+					p->nice, p->pc_cpu, p->cputime, p->memsize);
+			if(globals.io && p->io_known)
+				out_fmt("%.0f,%.0f,%.0f,", p->read_rate, p->write_rate, p->syscall_rate);
+			else if(globals.io)
+				out_str(",,,");
+			out_fmt("%s,", p->tty ? p->tty : "");
+			out_csv(cmd);
+			out_add("\n", 1);
+			break;
+
+		case BATCH_JSON:
+			out_fmt("\"pid\":%d,\"ppid\":%d,\"user\":", p->pid, p->ppid);
+			out_json(user(p));
+			out_fmt(",\"state\":\"%s\",\"nice\":%d,\"cpu\":%.1f,\"cputime\":%lu,\"rss\":%lu,",
+					proc_state_str(p), p->nice, p->pc_cpu, p->cputime, p->memsize);
+			if(globals.io && p->io_known)
+				out_fmt("\"read\":%.0f,\"write\":%.0f,\"syscalls\":%.0f,",
+						p->read_rate, p->write_rate, p->syscall_rate);
+			else if(globals.io)
+				out_str("\"read\":null,\"write\":null,\"syscalls\":null,");
+			out_str("\"tty\":");
+			out_json(p->tty ? p->tty : "");
+			out_str(",\"cmd\":");
+			out_json(cmd);
+			out_str("}\n");
+			break;
+	}
+}
+
+static void batch_exited(struct seen *s, enum batch_format fmt)
+{
+	switch(fmt){
+		case BATCH_TEXT:
+			out_fmt("% 11d exited\n", s->pid);
+			break;
+		case BATCH_CSV:
+			out_fmt("%d,,,exited,,,,,,%s\n", s->pid, globals.io ? ",,," : "");
+			break;
+		case BATCH_JSON:
+			out_fmt("\"pid\":%d,\"state\":\"exited\"}\n", s->pid);
+			break;
+	}
+}
+
+static void batch_snapshot(struct snapshot *snap, enum batch_format fmt, int changed_only)
+{
+	struct proctable *const procs = snap->procs;
+	const int nrows = proc_row_count(procs);
+	struct timeval tv;
+	long long now_ms;
+	int i;
+
+	gettimeofday(&tv, NULL);
+	now_ms = tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+
+	if(fmt == BATCH_TEXT){
+		char when[32];
+		const time_t t = tv.tv_sec;
+
+		strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", localtime(&t));
+		out_fmt("--- %s, %d processes, %d running\n", when,
+				snap->info.count, snap->info.procs_in_state[PROC_STATE_RUN]);
+	}
+
+	if(changed_only)
+		seen_begin(nrows);
+
+	for(i = 0; i < nrows; i++){
+		struct myproc *p = proc_from_idx(procs, i);
+		const size_t rec = out_len;
+		size_t start;
+
+		batch_time(fmt, now_ms);
+		start = out_len;
+		batch_proc(p, fmt);
+
+		if(changed_only && seen_same(p, hash(out + start, out_len - start)))
+			out_len = rec;
+
+		if(out_len >= OUT_FLUSH)
+			out_flush();
+	}
+
+	if(changed_only){
+		size_t j;
+
+		for(j = 0; seen && j < nseen; j++){
+			struct seen *s = &seen[j], *now;
+
+			if(!s->pid)
+				continue;
+
+			now = seen_find(seen_next, nseen_next, s->pid);
+			if(now->pid != s->pid || now->starttime != s->starttime){
+				batch_time(fmt, now_ms);
+				batch_exited(s, fmt);
+			}
+		}
+		seen_end();
+	}
+
+	out_flush();
+}
+
+int batch_format_parse(const char *s, enum batch_format *fmt)
+{
+	if(!strcmp(s, "text"))
+		*fmt = BATCH_TEXT;
+	else if(!strcmp(s, "csv"))
+		*fmt = BATCH_CSV;
+	else if(!strcmp(s, "json"))
+		*fmt = BATCH_JSON;
+	else
+		return -1;
+	return 0;
+}
+
+void batch_run(enum batch_format fmt, long period_ms, long count, int changed_only)
+{
+	/* the first snapshot goes straight back - the collector's own first
+	 * comes at once, and from then on every period_ms. Each table's first
+	 * update has nothing to take cpu use against, so the collector's first
+	 * is only a sample, and isn't written (n = -1) */
+	struct snapshot *snap = collect_init(period_ms);
+	long n;
+
+	if(fmt == BATCH_CSV){
+		out_str(globals.io
+				? "time,pid,ppid,user,state,nice,cpu,cputime,rss,read,write,syscalls,tty,cmd\n"
+				: "time,pid,ppid,user,state,nice,cpu,cputime,rss,tty,cmd\n");
+		out_flush();
+	}
+
+	for(n = -1; !count || n < count; n++){
+		struct snapshot *newer;
+
+		while(!(newer = collect_take())){
+			struct pollfd fd = { .fd = collect_fd(), .events = POLLIN };
+
+			if(poll(&fd, 1, -1) == -1 && errno != EINTR){
+				perror("poll()");
+				exit(1);
+			}
+			collect_ack();
+		}
+
+		collect_give(snap);
+		snap = newer;
+
+		if(n >= 0)
+			batch_snapshot(snap, fmt, changed_only);
+	}
+
+	collect_term();
+}
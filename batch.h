@@ -0,0 +1,18 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+enum batch_format
+{
+	BATCH_TEXT,
+	BATCH_CSV,
+	BATCH_JSON,
+};
+
+int batch_format_parse(const char *, enum batch_format *);
+/* "text", "csv" or "json" - 0 on success */
+
+void batch_run(enum batch_format, long period_ms, long count, int changed_only);
+/* write a snapshot to stdout every period_ms, count times, or forever if
+ * count is 0. With changed_only, only new, changed and exited processes */
+
+#endif
@@ -0,0 +1,73 @@
+/* Times the collector's work - proc_update() and machine_update() - over
+ * the live /proc, without the gui, then again for each reader thread count
+ * in jobs[]. See "make bench" */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "structs.h"
+#include "proc.h"
+#include "machine.h"
+#include "pool.h"
+#include "main.h"
+
+/* normally main.c's */
+struct globals globals;
+int max_unam_len, max_gnam_len;
+int ps_from_file;
+
+static const int jobs[] = { 1, 2, 4, 8, 16 };
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+	struct proctable *procs;
+	struct sysinfo info;
+	long i, n = 200;
+	size_t j;
+	double t;
+
+	if(argc > 2 || (argc == 2 && (n = strtol(argv[1], NULL, 10)) < 1)){
+		fprintf(stderr, "Usage: %s [updates]\n", *argv);
+		return 1;
+	}
+
+	globals.uid = getuid();
+	pool_init(1);
+	machine_init(&info);
+	procs = proc_init();
+
+	/* the first update finds everything new */
+	t = now_us();
+	proc_update(procs, &info);
+	machine_update(&info);
+	printf("%d processes, first update: %.0fus\n", info.count, now_us() - t);
+
+	pool_term();
+
+	for(j = 0; j < sizeof jobs / sizeof *jobs; j++){
+		pool_init(jobs[j]);
+
+		t = now_us();
+		for(i = 0; i < n; i++){
+			proc_update(procs, &info);
+			machine_update(&info);
+		}
+		printf("-j %-2d %ld updates: %.0fus each\n",
+				jobs[j], n, (now_us() - t) / n);
+
+		pool_term();
+	}
+
+	machine_term();
+	return 0;
+}
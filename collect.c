@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#ifdef __linux__
+#  include <stdint.h>
+#  include <sys/timerfd.h>
+#endif
+
+#include "structs.h"
+#include "collect.h"
+#include "proc.h"
+#include "machine.h"
+#include "util.h"
+
+/* Updates run on a thread of their own, alternating between two
+ * snapshots. A finished snapshot is published by swapping it into
+ * `published'. The gui takes it from there, handing its previous one
+ * back through `spare', which is what the collector fills next:
+ *
+ *   collector -> published -> gui -> spare -> collector
+ *
+ * The hand-off is lock-free. Each side sleeps in poll() and is woken
+ * through a pipe: the gui when there's a snapshot, the collector for a
+ * refresh, a spare or to quit. Between updates, the collector waits on
+ * a timer, and while the gui sits on a snapshot (e.g. frozen), it waits
+ * for the spare - so neither spins.
+ */
+static struct snapshot snapshots[2];
+static struct snapshot *published, *spare;
+
+static pthread_t collector;
+static int wake_pipe[2], ready_pipe[2];
+static int want_refresh, want_reread, quit;
+static long period;
+
+/* processes the gui wants more of - those on show, for
+ * machine_update_detail(), those with their threads expanded, and the
+ * one zoomed in on, if any */
+struct idlist
+{
+	struct procid *ids;
+	size_t n, max;
+};
+static pthread_mutex_t want_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct idlist wanted, threaded, zoomed;
+
+static void poke(int fd)
+{
+	const char c = 0;
+
+	/* full is fine - it's already readable */
+	if(write(fd, &c, 1) == -1 && errno != EAGAIN)
+		perror("write()");
+}
+
+static void drain(int fd)
+{
+	char buf[64];
+
+	while(read(fd, buf, sizeof buf) > 0);
+}
+
+static void pipe_init(int fds[2])
+{
+	int i;
+
+	if(pipe(fds)){
+		perror("pipe()");
+		exit(1);
+	}
+
+	for(i = 0; i < 2; i++){
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+}
+
+static void idlist_set(struct idlist *l, const struct procid *ids, size_t n)
+{
+	if(l->max < n){
+		l->max = n;
+		l->ids = urealloc(l->ids, l->max * sizeof *l->ids);
+	}
+	if(n)
+		memcpy(l->ids, ids, n * sizeof *ids);
+	l->n = n;
+}
+
+static void collect(struct snapshot *snap)
+{
+	/* copies, so the gui isn't held up by the reads */
+	static struct idlist show, threads, zoom;
+	struct myproc *p;
+	size_t i;
+
+	pthread_mutex_lock(&want_lock);
+	idlist_set(&show, wanted.ids, wanted.n);
+	idlist_set(&threads, threaded.ids, threaded.n);
+	idlist_set(&zoom, zoomed.ids, zoomed.n);
+	pthread_mutex_unlock(&want_lock);
+
+	proc_zoom(snap->procs, zoom.n ? zoom.ids : NULL);
+	proc_update(snap->procs, &snap->info);
+	proc_update_threads(snap->procs, threads.ids, threads.n);
+
+	for(i = 0; i < show.n; i++)
+		if((p = proc_get_id(snap->procs, &show.ids[i])))
+			machine_update_detail(p);
+
+	machine_update(&snap->info);
+
+	snprintf(snap->alloc_str, sizeof snap->alloc_str, "%s", proc_alloc_str());
+}
+
+#ifdef __linux__
+static int timer_fd = -1;
+
+static void timer_init(void)
+{
+	struct itimerspec its;
+
+	if((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1){
+		perror("timerfd_create()");
+		exit(1);
+	}
+
+	its.it_interval.tv_sec  = period / 1000;
+	its.it_interval.tv_nsec = period % 1000 * 1000000;
+	its.it_value.tv_sec  = 0;
+	its.it_value.tv_nsec = 1; /* first update straight away */
+	timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+/* sleep until the next update is due or we're poked. 1 if due */
+static int timer_wait(void)
+{
+	struct pollfd fds[2] = {
+		{ .fd = timer_fd,     .events = POLLIN },
+		{ .fd = wake_pipe[0], .events = POLLIN },
+	};
+	uint64_t ticks;
+
+	if(poll(fds, 2, -1) == -1)
+		return 0;
+	if(fds[1].revents & POLLIN)
+		drain(wake_pipe[0]);
+
+	return read(timer_fd, &ticks, sizeof ticks) == sizeof ticks;
+}
+#else
+static long timer_due;
+
+static void timer_init(void)
+{
+	timer_due = mstime();
+}
+
+static int timer_wait(void)
+{
+	struct pollfd fd = { .fd = wake_pipe[0], .events = POLLIN };
+	long ms = timer_due - mstime();
+
+	if(ms > 0 && poll(&fd, 1, ms) > 0){
+		drain(wake_pipe[0]);
+		return 0;
+	}
+
+	timer_due = mstime() + period;
+	return 1;
+}
+#endif
+
+static void *collect_thread(void *arg)
+{
+	struct snapshot *back = arg;
+
+	timer_init();
+
+	for(;;){
+		const int due = timer_wait();
+
+		if(__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+			break;
+		if(!due && !__atomic_exchange_n(&want_refresh, 0, __ATOMIC_ACQ_REL))
+			continue;
+
+		/* one for each snapshot */
+		if(__atomic_load_n(&want_reread, __ATOMIC_ACQUIRE) > 0){
+			__atomic_sub_fetch(&want_reread, 1, __ATOMIC_ACQ_REL);
+			proc_reread_argv(back->procs);
+		}
+		collect(back);
+
+		__atomic_store_n(&published, back, __ATOMIC_RELEASE);
+		poke(ready_pipe[1]);
+
+		while(!(back = __atomic_exchange_n(&spare, NULL, __ATOMIC_ACQ_REL))){
+			struct pollfd fd = { .fd = wake_pipe[0], .events = POLLIN };
+
+			if(__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+				return NULL;
+
+			poll(&fd, 1, -1);
+			drain(wake_pipe[0]);
+		}
+	}
+
+	return NULL;
+}
+
+struct snapshot *collect_init(long period_ms)
+{
+	struct snapshot *const front = &snapshots[0];
+	struct snapshot *const back = &snapshots[1];
+
+	period = period_ms;
+	pipe_init(wake_pipe);
+	pipe_init(ready_pipe);
+
+	/* not copied - each has its own allocations */
+	machine_init(&front->info);
+	machine_info_init(&back->info);
+
+	front->procs = proc_init();
+	back->procs = proc_init();
+
+	collect(front);
+
+	if(pthread_create(&collector, NULL, collect_thread, back)){
+		perror("pthread_create()");
+		exit(1);
+	}
+
+	return front;
+}
+
+void collect_term(void)
+{
+	__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+	poke(wake_pipe[1]);
+
+	pthread_join(collector, NULL);
+}
+
+int collect_fd(void)
+{
+	return ready_pipe[0];
+}
+
+void collect_ack(void)
+{
+	drain(ready_pipe[0]);
+}
+
+struct snapshot *collect_take(void)
+{
+	return __atomic_exchange_n(&published, NULL, __ATOMIC_ACQ_REL);
+}
+
+void collect_give(struct snapshot *snap)
+{
+	__atomic_store_n(&spare, snap, __ATOMIC_RELEASE);
+	poke(wake_pipe[1]);
+}
+
+void collect_want(const struct procid *ids, size_t n)
+{
+	pthread_mutex_lock(&want_lock);
+	idlist_set(&wanted, ids, n);
+	pthread_mutex_unlock(&want_lock);
+}
+
+void collect_threads(const struct procid *ids, size_t n)
+{
+	pthread_mutex_lock(&want_lock);
+	idlist_set(&threaded, ids, n);
+	pthread_mutex_unlock(&want_lock);
+}
+
+void collect_zoom(const struct procid *id)
+{
+	pthread_mutex_lock(&want_lock);
+	idlist_set(&zoomed, id, !!id);
+	pthread_mutex_unlock(&want_lock);
+}
+
+void collect_refresh(int reread_argv)
+{
+	if(reread_argv)
+		__atomic_store_n(&want_reread, 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&want_refresh, 1, __ATOMIC_RELEASE);
+	poke(wake_pipe[1]);
+}
@@ -0,0 +1,39 @@
+#ifndef COLLECT_H
+#define COLLECT_H
+
+/* one complete update - the process table and system info with it */
+struct snapshot
+{
+	struct proctable *procs;
+	struct sysinfo info;
+	char alloc_str[64]; /* proc_alloc_str(), as of this update */
+};
+
+struct snapshot *collect_init(long period_ms);
+/* takes the first snapshot, returning it, then starts the collector,
+ * updating every period_ms */
+void collect_term(void);
+
+int collect_fd(void);
+/* readable when there may be a new snapshot - collect_ack() to clear */
+void collect_ack(void);
+
+struct snapshot *collect_take(void);
+/* the latest snapshot, or NULL if there's been none since the last take */
+void collect_give(struct snapshot *);
+/* hand back the previous snapshot, for the collector to reuse */
+
+void collect_refresh(int reread_argv);
+/* update now, rather than waiting out the period */
+
+void collect_want(const struct procid *ids, size_t n);
+/* the processes on show, which get their costlier figures read too
+ * (see machine_update_detail()), from the next update on */
+
+void collect_threads(const struct procid *ids, size_t n);
+/* the processes to list the threads of, likewise */
+
+void collect_zoom(const struct procid *id);
+/* collect only id's subtree, or everything if NULL - see proc_zoom() */
+
+#endif
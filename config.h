@@ -51,6 +51,11 @@
 #define BASENAME_TOGGLE_CHAR 'b'
 #define READ_FROM_PS_FILE_CHAR 'P'
 #define FOLD_CHAR '-'
+#define CPU_TOGGLE_CHAR 'c'
+#define MEM_SORT_CHAR 'm'
+#define IO_TOGGLE_CHAR 'D'
+#define THREADS_CHAR 'T'
+#define ZOOM_CHAR 'Z'
 
 // Colors
 
@@ -69,12 +74,23 @@
 
 #define ATTR_NOT_OWNED      COLOR_PAIR(1 + COLOR_BLACK) | A_BOLD
 #define ATTR_LOCK           COLOR_PAIR(1 + COLOR_MAGENTA)
+#define ATTR_THREAD         COLOR_PAIR(1 + COLOR_GREEN)
 #define ATTR_JAILED         COLOR_PAIR(1 + COLOR_BLUE) | A_BOLD
 
 #define BASENAME_COL   (1 + COLOR_CYAN)
 #define BASENAME_ATTR  A_BOLD
 
-typedef void proc_handler(struct myproc *, struct myproc **);
+/* the per-cpu strip - a cell's character says how busy, 0%, 10%, .. 100%,
+ * and its colour what on */
+#define CPU_STRIP_CHARS ".123456789#"
+#define ATTR_CPU_USER       COLOR_PAIR(1 + COLOR_GREEN)
+#define ATTR_CPU_NICE       COLOR_PAIR(1 + COLOR_BLUE)
+#define ATTR_CPU_SYS        COLOR_PAIR(1 + COLOR_RED)
+#define ATTR_CPU_IOWAIT     COLOR_PAIR(1 + COLOR_MAGENTA)
+#define ATTR_CPU_IRQ        COLOR_PAIR(1 + COLOR_YELLOW)
+#define ATTR_CPU_STEAL      COLOR_PAIR(1 + COLOR_CYAN)
+
+typedef void proc_handler(struct myproc *, struct proctable *);
 
 proc_handler delete, renice, lsof, strace, gdb, shell;
 
@@ -13,10 +13,15 @@
 
 #include <signal.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#  include <sys/signalfd.h>
+#endif
 
 #include "structs.h"
 
@@ -26,13 +31,14 @@
 #include "config.h"
 #include "main.h"
 #include "machine.h"
+#include "collect.h"
 #include "util.h"
 
-#define TOP_OFFSET 3
+#define TOP_OFFSET (3 + cpu_rows)
 #define DRAW_SPACE (LINES - TOP_OFFSET - 1)
 
 #define STATUS(y, x, ...) do{ mvprintw(y, x, __VA_ARGS__); clrtoeol(); }while(0)
-#define WAIT_STATUS(...) do{ STATUS(0, 0, __VA_ARGS__); ungetch(getch()); }while(0)
+#define WAIT_STATUS(...) do{ STATUS(0, 0, __VA_ARGS__); ungetch(getch_wait(HALF_DELAY_TIME)); }while(0)
 
 #define SEARCH_ON(on) do{ gui_text_entry(on); search = on; *search_str = '\0'; }while(0)
 
@@ -49,7 +55,39 @@ static struct myproc *search_proc = NULL;
 
 static int frozen = 0;
 
-static pid_t lock_proc_pid = -1;
+/* the per-cpu strip under the header, and the lines it takes */
+static int show_cpus = 0, cpu_rows = 0;
+
+static enum proc_sort sort_by = PROC_SORT_PID;
+
+/* before a cpu strip line, the number of its first cpu */
+#define CPU_LABEL_WIDTH 5
+
+/* SIGWINCH, as a descriptor. Elsewhere, ncurses' handler gives us KEY_RESIZE */
+static int winch_fd = -1;
+
+/* Per screen line, a hash of the process row last drawn there - a row
+ * that hashes the same is left alone. Anything else that draws over the
+ * process area must call damage() */
+static unsigned long long *drawn;
+static int ndrawn;
+
+/* the processes on those lines, passed to collect_want() */
+static struct procid *shown;
+
+/* the last frame's refresh(), for -d */
+static long frame_usec;
+
+static struct procid lock_proc = { -1, 0 };
+/* the head of the only subtree shown, see proc_zoom() */
+static struct procid zoom = { -1, 0 };
+
+/* kept here too, to carry them across snapshots */
+static struct procid *folds;
+static size_t nfolds, folds_max;
+/* the processes with their threads listed, see collect_threads() */
+static struct procid *threaded;
+static size_t nthreaded, threaded_max;
 static struct
 {
 	pid_t pid, ppid;
@@ -57,10 +95,67 @@ static struct
 
 static void getch_delay(int on)
 {
-	if(on)
-		halfdelay(HALF_DELAY_TIME); /* x/10s of a second wait */
-	else
-		cbreak();
+	/* the main loop only reads once poll() says there's input */
+	cbreak();
+	nodelay(stdscr, on);
+}
+
+static void gui_refresh(void)
+{
+	struct timeval a, b;
+
+	gettimeofday(&a, NULL);
+	refresh();
+	gettimeofday(&b, NULL);
+
+	frame_usec = (b.tv_sec - a.tv_sec) * 1000000L + (b.tv_usec - a.tv_usec);
+}
+
+/* wait up to tenths/10s for a key */
+static int getch_wait(int tenths)
+{
+	int ch;
+
+	gui_refresh();
+	timeout(tenths * 100);
+	ch = getch();
+	getch_delay(1);
+
+	return ch;
+}
+
+static void winch_block(int block)
+{
+#ifdef __linux__
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGWINCH);
+	sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+#else
+	(void)block;
+#endif
+}
+
+static void damage(void)
+{
+	if(drawn)
+		memset(drawn, 0, ndrawn * sizeof *drawn);
+}
+
+static void gui_clear(void)
+{
+	clear();
+	damage();
+}
+
+static void gui_resize(void)
+{
+	struct winsize ws;
+
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+		resizeterm(ws.ws_row, ws.ws_col);
+	gui_clear();
 }
 
 static void gui_text_entry(int on)
@@ -72,6 +167,15 @@ static void gui_text_entry(int on)
 	curs_set(on);
 }
 
+static void getnstr_wait(char *buf, int n)
+{
+	gui_text_entry(1);
+	getch_delay(0);
+	getnstr(buf, n);
+	getch_delay(1);
+	gui_text_entry(0);
+}
+
 void gui_init()
 {
 	static int init = 0;
@@ -81,6 +185,18 @@ void gui_init()
 	}else{
 		init = 1;
 
+#ifdef __linux__
+		{
+			sigset_t set;
+
+			/* before any threads start, so they all leave it to winch_fd */
+			winch_block(1);
+			sigemptyset(&set);
+			sigaddset(&set, SIGWINCH);
+			winch_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+		}
+#endif
+
 		initscr();
 		noecho();
 		cbreak();
@@ -117,14 +233,51 @@ void gui_term()
 	endwin();
 }
 
-static void unfold(struct myproc *p, struct myproc **procs)
+static void procids_add(struct procid **ids, size_t *n, size_t *max, struct myproc *p)
+{
+	if(*n == *max){
+		*max = *max ? *max * 2 : 16;
+		*ids = urealloc(*ids, *max * sizeof **ids);
+	}
+	(*ids)[*n].pid = p->pid;
+	(*ids)[*n].starttime = p->starttime;
+	++*n;
+}
+
+/* 1 if p was there */
+static int procids_del(struct procid *ids, size_t *n, struct myproc *p)
+{
+	size_t i;
+
+	for(i = 0; i < *n; i++){
+		if(ids[i].pid == p->pid && ids[i].starttime == p->starttime){
+			ids[i] = ids[--*n];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void fold(struct proctable *procs, struct myproc *p, int on)
+{
+	if(!p->folded == !on)
+		return;
+	proc_fold(procs, p, on);
+
+	if(on)
+		procids_add(&folds, &nfolds, &folds_max, p);
+	else
+		procids_del(folds, &nfolds, p);
+}
+
+static void unfold(struct myproc *p, struct proctable *procs)
 {
 	/* don't unfold `p` itself, just its parents */
-	while(p && (p = proc_get(procs, p->ppid)))
-		p->folded = 0;
+	while(p && (p = p->parent))
+		fold(procs, p, 0);
 }
 
-static int search_proc_to_idx(int *y, struct myproc **procs)
+static int search_proc_to_idx(int *y, struct proctable *procs)
 {
 	*y = 0;
 	if(search_proc)
@@ -132,10 +285,9 @@ static int search_proc_to_idx(int *y, struct myproc **procs)
 	return proc_to_idx(procs, search_proc, y);
 }
 
-static struct myproc *curproc(struct myproc **procs)
+static struct myproc *curproc(struct proctable *procs)
 {
-	int i = pos_y;
-	return proc_from_idx(procs, &i);
+	return proc_from_idx(procs, pos_y);
 }
 
 static void unfocus(void)
@@ -143,10 +295,12 @@ static void unfocus(void)
 	current.pid = 0;
 }
 
-static void position(int newy, struct myproc **procs)
+static void position(int newy, struct proctable *procs)
 {
 	pos_y = newy;
 
+	if(pos_y >= proc_row_count(procs))
+		pos_y = proc_row_count(procs) - 1;
 	if(pos_y < 0)
 		pos_y = 0;
 
@@ -170,7 +324,7 @@ static void sideways(int newx)
 	pos_x = MAX(newx, 0);
 }
 
-static void goto_proc(struct myproc **procs, struct myproc *p)
+static void goto_proc(struct proctable *procs, struct myproc *p)
 {
 	if(!p)
 		return;
@@ -181,137 +335,345 @@ static void goto_proc(struct myproc **procs, struct myproc *p)
 		position(y, procs);
 }
 
-static void goto_me(struct myproc **procs)
+static void goto_me(struct proctable *procs)
 {
 	goto_proc(procs, proc_get(procs, getpid()));
 }
 
-static void goto_lock(struct myproc **procs)
+static void goto_lock(struct proctable *procs)
 {
-	if(lock_proc_pid == -1){
+	if(lock_proc.pid == -1){
 		attron( COLOR_PAIR(1 + COLOR_RED));
 		WAIT_STATUS("no process locked on");
 		attroff(COLOR_PAIR(1 + COLOR_RED));
 	}else{
-		goto_proc(procs, proc_get(procs, lock_proc_pid));
+		goto_proc(procs, proc_get_id(procs, &lock_proc));
 	}
 }
 
-static void showproc(struct myproc *proc, int *py, int indent, int in_fold)
+/* list p's threads under it, or stop - they come with the next update */
+static void toggle_threads(struct proctable *procs, struct myproc *p)
 {
-	int y = *py;
+	if(p->is_thread)
+		p = p->parent;
+	if(!p)
+		return;
 
-	proc->mark = 1;
+	if(!procids_del(threaded, &nthreaded, p)){
+		procids_add(&threaded, &nthreaded, &threaded_max, p);
+		fold(procs, p, 0);
+	}
+	goto_proc(procs, p);
 
-	if(in_fold)
-		goto out;
-	if(y >= LINES)
-		return;
+	collect_threads(threaded, nthreaded);
+	collect_refresh(0);
+}
 
-	if(y >= TOP_OFFSET){ // otherwise we're iterating over a process that's above pos_top
-		const int is_owned         = ps_from_file || proc->uid == globals.uid;
-		const int is_locked        = proc->pid == lock_proc_pid;
-		const int is_searched      = proc      == search_proc;
-		const int is_searched_alt  = *search_str
-		                             && proc->shell_cmd
-		                             && strstr(proc->shell_cmd, search_str);
+/* show only the locked process's subtree (or p's, if none), or everything
+ * again. The cursor stays put, as far as it can */
+static void toggle_zoom(struct proctable *procs, struct myproc *p)
+{
+	struct myproc *locked;
 
-		const unsigned linebuf_len = COLS + pos_x + 1;
-		char *linebuf = umalloc(linebuf_len);
-		memset(linebuf, ' ', linebuf_len);
-		linebuf[linebuf_len-1] = '\0';
+	if(zoom.pid != -1){
+		WAIT_STATUS("unzoomed from process %d", zoom.pid);
+		zoom.pid = -1;
+	}else{
+		if(lock_proc.pid != -1 && (locked = proc_get_id(procs, &lock_proc)))
+			p = locked;
+		else if(p && p->is_thread)
+			p = p->parent;
 
-		int linebuf_used = snprintf(linebuf, linebuf_len, "%s",
-				machine_proc_display_line(proc));
+		if(!p){
+			WAIT_STATUS("no process to zoom to");
+			return;
+		}
+		zoom.pid = p->pid;
+		zoom.starttime = p->starttime;
+		WAIT_STATUS("zoomed to process %d", zoom.pid);
+	}
 
-		const unsigned total_indent = SPACE_CMDLINE + SPACE_INDENT * indent;
-		if(linebuf_used >= 0 && (unsigned)linebuf_used < linebuf_len){
-			char *end = linebuf + linebuf_used;
-			*end = ' ';
+	proc_zoom(procs, zoom.pid == -1 ? NULL : &zoom);
+	goto_proc(procs, p);
 
-			if((unsigned)linebuf_used + total_indent < linebuf_len){
-				char *linepos = end + total_indent;
+	collect_zoom(zoom.pid == -1 ? NULL : &zoom);
+	collect_refresh(0);
+}
 
-				snprintf(linepos, linebuf_len - (linepos - linebuf),
-						"%s", globals.basename ? proc->argv0_basename : proc->shell_cmd);
-			}
-		}
+/* FNV-1a */
+static unsigned long long fingerprint(unsigned long long h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
 
-		move(y, 0);
-		clrtoeol();
+	while(n--)
+		h = (h ^ *s++) * 1099511628211ULL;
 
-		if(is_searched)
-			attron(ATTR_SEARCH);
-		else if(is_locked)
-			attron(ATTR_LOCK);
-		else if(is_searched_alt)
-			attron(ATTR_SEARCH_ALT);
-		else if(!is_owned)
-			attron(ATTR_NOT_OWNED);
-
-		printw("% 11d%c%s", proc->pid, proc->folded ? '-' : ' ', linebuf + pos_x);
-
-		if(is_searched)
-			attroff(ATTR_SEARCH);
-		else if(is_locked)
-			attroff(ATTR_LOCK);
-		else if(is_searched_alt)
-			attroff(ATTR_SEARCH_ALT);
-		else if(!is_owned)
-			attroff(ATTR_NOT_OWNED);
-
-		/* basename shading */
-		if(!globals.basename
-		&& is_owned
-		&& !is_locked
-		&& !is_searched
-		&& !is_searched_alt
-		&& proc->argv)
-		{
-			const ptrdiff_t bname_off = proc->argv0_basename - proc->argv[0];
-			size_t off = machine_proc_display_width()
-				+ bname_off + total_indent - pos_x;
+	return h;
+}
+
+/* what's under a folded row, and the row itself, ahead of its command */
+static const char *tree_str(const struct myproc *p)
+{
+	static char buf[80];
+	char rss[16], rd[16], wr[16];
+	int n;
 
-			if(2 <= off && off < (size_t)COLS){
-				const size_t bn_len = strlen(proc->argv0_basename);
+	if(!p->folded || p->tree.count < 2)
+		return "";
 
-				/* y, x, n, attr, color, opts */
-				/* + 10 for "% 11d" above */
-				mvchgat(y, off + 10, bn_len, BASENAME_ATTR, BASENAME_COL, NULL);
-			}
+	n = snprintf(buf, sizeof buf, "[+%lu %.1f%% %s", p->tree.count - 1, p->tree.cpu / 100.0,
+			format_kbytes_r(p->tree.rss, rss, sizeof rss));
+
+	if(globals.io && n > 0 && (size_t)n < sizeof buf)
+		n += snprintf(buf + n, sizeof buf - n, " %s/%s",
+				format_kbytes_r(p->tree.read / 1024, rd, sizeof rd),
+				format_kbytes_r(p->tree.write / 1024, wr, sizeof wr));
+	if(n > 0 && (size_t)n < sizeof buf)
+		snprintf(buf + n, sizeof buf - n, "] ");
+
+	return buf;
+}
+
+static void showproc(struct myproc *proc, int y, int is_cursor)
+{
+	/* reused from line to line, and frame to frame */
+	static char *linebuf;
+	static unsigned linebuf_max;
+
+	const int indent = proc->depth;
+	const int is_owned         = ps_from_file || proc->uid == globals.uid;
+	const int is_locked        = proc->pid == lock_proc.pid
+	                             && proc->starttime == lock_proc.starttime;
+	const int is_searched      = proc      == search_proc;
+	const int is_searched_alt  = *search_str
+	                             && proc->shell_cmd
+	                             && strstr(proc->shell_cmd, search_str);
+	const int is_thread        = proc->is_thread;
+	const char *const tree     = tree_str(proc);
+
+	const unsigned linebuf_len = COLS + pos_x + 1;
+	if(linebuf_max < linebuf_len){
+		linebuf_max = linebuf_len;
+		linebuf = urealloc(linebuf, linebuf_max);
+	}
+	memset(linebuf, ' ', linebuf_len);
+	linebuf[linebuf_len-1] = '\0';
+
+	int linebuf_used = snprintf(linebuf, linebuf_len, "%s",
+			machine_proc_display_line(proc));
+
+	const unsigned total_indent = SPACE_CMDLINE + SPACE_INDENT * indent;
+	if(linebuf_used >= 0 && (unsigned)linebuf_used < linebuf_len){
+		char *end = linebuf + linebuf_used;
+		*end = ' ';
+
+		if((unsigned)linebuf_used + total_indent < linebuf_len){
+			char *linepos = end + total_indent;
+
+			snprintf(linepos, linebuf_len - (linepos - linebuf),
+					"%s%s", tree, globals.basename ? proc->argv0_basename : proc->shell_cmd);
 		}
+	}
+
+	{
+		const long state[] = {
+			proc->pid, proc->folded, pos_x, indent,
+			is_owned, is_locked, is_searched, is_searched_alt, is_thread, is_cursor,
+			proc->argv ? proc->argv0_basename - proc->argv[0] : -1,
+		};
+		unsigned long long fp = 14695981039346656037ULL;
 
-		free(linebuf);
+		fp = fingerprint(fp, state, sizeof state);
+		fp = fingerprint(fp, linebuf + pos_x, strlen(linebuf + pos_x));
+		fp |= 1; /* 0 is "unknown" */
+
+		if(drawn[y] == fp)
+			return;
+		drawn[y] = fp;
 	}
 
-	// done with our proc, increment y
-	y++;
+	move(y, 0);
+	clrtoeol();
 
-out:
-	/*
-	 * need to iterate over all children,
-	 * since we may currently be on a process above the top
-	 */
-	for(struct myproc **iter = proc->children; iter && *iter; iter++)
-		showproc(*iter, &y, indent + 1, in_fold || proc->folded);
+	if(is_searched)
+		attron(ATTR_SEARCH);
+	else if(is_locked)
+		attron(ATTR_LOCK);
+	else if(is_searched_alt)
+		attron(ATTR_SEARCH_ALT);
+	else if(is_thread)
+		attron(ATTR_THREAD);
+	else if(!is_owned)
+		attron(ATTR_NOT_OWNED);
+
+	/* kept to the line - wrapping would spill into the next row, which
+	 * may not be redrawn */
+	printw("% 11d%c%.*s", proc->pid, proc->folded ? '-' : ' ',
+			COLS > 12 ? COLS - 12 : 0, linebuf + pos_x);
+
+	if(is_searched)
+		attroff(ATTR_SEARCH);
+	else if(is_locked)
+		attroff(ATTR_LOCK);
+	else if(is_searched_alt)
+		attroff(ATTR_SEARCH_ALT);
+	else if(is_thread)
+		attroff(ATTR_THREAD);
+	else if(!is_owned)
+		attroff(ATTR_NOT_OWNED);
+
+	/* basename shading */
+	if(!globals.basename
+	&& is_owned
+	&& !is_locked
+	&& !is_searched
+	&& !is_searched_alt
+	&& !is_thread
+	&& proc->argv)
+	{
+		const ptrdiff_t bname_off = proc->argv0_basename - proc->argv[0];
+		size_t off = machine_proc_display_width()
+			+ strlen(tree) + bname_off + total_indent - pos_x;
+
+		if(2 <= off && off < (size_t)COLS){
+			const size_t bn_len = strlen(proc->argv0_basename);
+
+			/* y, x, n, attr, color, opts */
+			/* + 10 for "% 11d" above */
+			mvchgat(y, off + 10, bn_len, BASENAME_ATTR, BASENAME_COL, NULL);
+		}
+	}
+}
 
-	*py = y;
+/* A cell per cpu, or if that would take over a third of the screen, per
+ * group of cpus. Returns the lines needed */
+static int cpu_layout(int ncpus, int *per_cell, int *per_row)
+{
+	const int max_rows = MAX(LINES / 3, 1);
+
+	*per_row = COLS - CPU_LABEL_WIDTH;
+	if(ncpus <= 0 || *per_row < 1)
+		return 0;
+
+	*per_cell = (ncpus + max_rows * *per_row - 1) / (max_rows * *per_row);
+	return ((ncpus + *per_cell - 1) / *per_cell + *per_row - 1) / *per_row;
 }
 
-static void showprocs(struct myproc **procs, struct sysinfo *info)
+/* what most of a cpu's busy time went on */
+static attr_t cpu_attr(const unsigned short *st)
 {
-	int y = TOP_OFFSET - pos_top;
+	const int irq = st[CPU_IRQ] + st[CPU_SOFTIRQ];
+	attr_t attr = ATTR_CPU_USER;
+	int most = st[CPU_USER];
+
+	if(st[CPU_NICE] > most)
+		most = st[CPU_NICE], attr = ATTR_CPU_NICE;
+	if(st[CPU_SYS] > most)
+		most = st[CPU_SYS], attr = ATTR_CPU_SYS;
+	if(st[CPU_IOWAIT] > most)
+		most = st[CPU_IOWAIT], attr = ATTR_CPU_IOWAIT;
+	if(irq > most)
+		most = irq, attr = ATTR_CPU_IRQ;
+	if(st[CPU_STEAL] > most)
+		attr = ATTR_CPU_STEAL;
+
+	return attr;
+}
 
-	proc_unmark(procs);
+static void showcpus(struct sysinfo *info, int y, int per_cell, int per_row)
+{
+	int cpu, x = 0;
 
-	if(!globals.kernel)
-		proc_mark_kernel(procs);
+	for(cpu = 0; cpu < info->ncpus; cpu += per_cell){
+		const unsigned short *busiest = NULL;
+		int busy = -1, i;
 
-	ITER_PROC_HEADS(struct myproc *, p, procs)
-		showproc(p, &y, 0, 0);
+		if(x == 0)
+			mvprintw(y, 0, "%*d ", CPU_LABEL_WIDTH - 1, cpu);
 
-	move(y, 0);
-	clrtobot();
+		for(i = cpu; i < cpu + per_cell && i < info->ncpus; i++){
+			const unsigned short *st = info->cpu_each[i];
+			int j, total = 0;
+
+			for(j = 0; j < CPU_NSTATES; j++)
+				total += st[j];
+
+			/* offline cpus have nothing */
+			if(total && 1000 - st[CPU_IDLE] > busy){
+				busy = 1000 - st[CPU_IDLE];
+				busiest = st;
+			}
+		}
+
+		if(busiest){
+			const attr_t attr = cpu_attr(busiest);
+
+			attron(attr);
+			addch(CPU_STRIP_CHARS[(MAX(busy, 0) + 50) / 100]);
+			attroff(attr);
+		}else{
+			addch(' ');
+		}
+
+		if(++x == per_row){
+			clrtoeol();
+			y++;
+			x = 0;
+		}
+	}
+	if(x)
+		clrtoeol();
+}
+
+static void showprocs(struct snapshot *snap)
+{
+	struct proctable *const procs = snap->procs;
+	struct sysinfo *const info = &snap->info;
+	struct myproc *p;
+	int cursor_y, y;
+
+	if(ndrawn != LINES){
+		ndrawn = LINES;
+		drawn = urealloc(drawn, ndrawn * sizeof *drawn);
+		shown = urealloc(shown, ndrawn * sizeof *shown);
+		damage();
+	}
+
+	{
+		int per_cell = 1, per_row = 1;
+		const int rows = show_cpus && info->cpu_each
+			? cpu_layout(info->ncpus, &per_cell, &per_row)
+			: 0;
+
+		if(rows != cpu_rows){
+			/* the process lines have moved */
+			cpu_rows = rows;
+			damage();
+			position(pos_y, procs);
+		}
+		if(cpu_rows)
+			showcpus(info, 3, per_cell, per_row);
+	}
+
+	cursor_y = search ? -1 : TOP_OFFSET + pos_y - pos_top;
+
+	/* only what's on screen - the rows are already laid out */
+	for(y = TOP_OFFSET; y < LINES && (p = proc_from_idx(procs, pos_top + y - TOP_OFFSET)); y++){
+		showproc(p, y, y == cursor_y);
+
+		shown[y - TOP_OFFSET].pid = p->pid;
+		shown[y - TOP_OFFSET].starttime = p->starttime;
+	}
+	collect_want(shown, y - TOP_OFFSET);
+
+	/* with the screen full, y is off the bottom - move() would fail and
+	 * leave clrtobot() to clear from wherever the cursor last was */
+	if(y < LINES){
+		move(y, 0);
+		clrtobot();
+	}
+	for(; y < LINES; y++)
+		drawn[y] = 0;
 
 	if(search){
 		const int red = !search_proc && *search_str;;
@@ -344,7 +706,15 @@ static void showprocs(struct myproc **procs, struct sysinfo *info)
 #endif
 				uptime_from_boottime(info->boottime.tv_sec));
 
-		STATUS(1, 0, "Mem: %s", machine_format_memory(info));
+		{
+			char frame[32] = "";
+
+			if(globals.debug)
+				snprintf(frame, sizeof frame, ", frame: %ldus", frame_usec);
+
+			STATUS(1, 0, "Mem: %s%s%s%s", machine_format_memory(info),
+					globals.debug ? ", " : "", globals.debug ? snap->alloc_str : "", frame);
+		}
 		STATUS(2, 0, "CPU: %s%s", machine_format_cpu_pct(info), frozen ? " [FROZEN]" : "");
 
 		y = TOP_OFFSET + pos_y - pos_top;
@@ -365,6 +735,7 @@ static int waitgetch()
 	int ret;
 	gui_text_entry(1);
 	getch_delay(0);
+	gui_refresh();
 	ret = getch();
 	getch_delay(1);
 	gui_text_entry(0);
@@ -390,9 +761,7 @@ static const char *confirm_read(const char *fmt, va_list l, unsigned maxlen)
 	vwprintw(stdscr, fmt, l);
 	clrtoeol();
 
-	gui_text_entry(1);
-	getnstr(buf, maxlen);
-	gui_text_entry(0);
+	getnstr_wait(buf, maxlen);
 
 	return buf;
 }
@@ -417,7 +786,7 @@ static int confirm_long(const char *fmt, ...)
 	return !strcmp(buf, "yes");
 }
 
-void delete(struct myproc *p, struct myproc **ps)
+void delete(struct myproc *p, struct proctable *ps)
 {
 	char sig[8];
 	int i, wait = 0;
@@ -428,9 +797,7 @@ void delete(struct myproc *p, struct myproc **ps)
 		return;
 
 	STATUS(0, 0, "kill %d (%s) with: ", p->pid, p->argv0_basename);
-	gui_text_entry(1);
-	getnstr(sig, sizeof sig);
-	gui_text_entry(0);
+	getnstr_wait(sig, sizeof sig);
 
 	if(!*sig)
 		return;
@@ -468,7 +835,7 @@ void delete(struct myproc *p, struct myproc **ps)
 	getch_delay(1);
 }
 
-void renice(struct myproc *p, struct myproc **ps)
+void renice(struct myproc *p, struct proctable *ps)
 {
 	char increment[4]; // -20 to 20
 	int i, wait = 0;
@@ -476,9 +843,7 @@ void renice(struct myproc *p, struct myproc **ps)
 	(void)ps;
 
 	STATUS(0, 0, "renice %d (%s) with [-20:20]: ", p->pid, p->argv0_basename);
-	gui_text_entry(1);
-	getnstr(increment, sizeof increment);
-	gui_text_entry(0);
+	getnstr_wait(increment, sizeof increment);
 
 	if(!*increment)
 		return;
@@ -509,12 +874,17 @@ static void external(const char *cmd)
 {
 	gui_term();
 
+	/* the child would inherit the mask */
+	winch_block(0);
 	system(cmd);
+	winch_block(1);
+
 	fputs("return to continue...", stdout);
 	fflush(stdout);
 	getchar();
 
 	gui_init();
+	gui_resize();
 }
 
 static void external2(const char *cmd, struct myproc *p)
@@ -532,19 +902,19 @@ static void external2(const char *cmd, struct myproc *p)
 	free(buf);
 }
 
-void strace(struct myproc *p, struct myproc **ps)
+void strace(struct myproc *p, struct proctable *ps)
 {
 	(void)ps;
 	external2(TRACE_TOOL, p);
 }
 
-void lsof(struct myproc *p, struct myproc **ps)
+void lsof(struct myproc *p, struct proctable *ps)
 {
 	(void)ps;
 	external2("lsof", p);
 }
 
-void shell(struct myproc *p, struct myproc **ps)
+void shell(struct myproc *p, struct proctable *ps)
 {
 	char buf[16];
 	char *sh = getenv("SHELL");
@@ -561,7 +931,7 @@ void shell(struct myproc *p, struct myproc **ps)
 	external(sh);
 }
 
-void gdb(struct myproc *p, struct myproc **ps)
+void gdb(struct myproc *p, struct proctable *ps)
 {
 	// Attach to a running process: gdb <name> <pid>
 	char *cmd;
@@ -587,7 +957,7 @@ void gdb(struct myproc *p, struct myproc **ps)
 	free(cmd);
 }
 
-static int try_external(int ch, struct myproc **procs)
+static int try_external(int ch, struct proctable *procs)
 {
 	struct myproc *const cp = curproc(procs);
 	int r = 0;
@@ -600,11 +970,11 @@ static int try_external(int ch, struct myproc **procs)
 	return r;
 }
 
-static void show_info(struct myproc *p, struct myproc **procs)
+static void show_info(struct myproc *p, struct proctable *procs)
 {
 	int i;
 
-	clear();
+	gui_clear();
 	mvprintw(2, 0,
 		"pid: %d, ppid: %d\n"
 		"uid: %d (%s), gid: %d (%s)\n"
@@ -612,8 +982,7 @@ static void show_info(struct myproc *p, struct myproc **procs)
 		"jid: %d\n"
 #endif
 		"state: %s, nice: %d\n"
-		"CPU time: %s, MEM size: %s\n"
-		"tty: %s\n"
+		"CPU time: %s, "
 		,
 		p->pid, p->ppid,
 		p->uid, p->unam, p->gid, p->gnam,
@@ -621,8 +990,25 @@ static void show_info(struct myproc *p, struct myproc **procs)
 		p->jid,
 #endif
 		proc_state_str(p), p->nice,
-		format_seconds(p->cputime), format_kbytes(p->memsize),
-		p->tty);
+		format_seconds(p->cputime));
+
+	printw("RSS: %s", format_kbytes(p->memsize));
+	if(p->mem_detail){
+		printw(", PSS: %s", format_kbytes(p->pss));
+		printw(", USS: %s", format_kbytes(p->uss));
+		printw(", swap: %s", format_kbytes(p->swap));
+	}
+	printw("\ntty: %s\n", p->tty);
+
+	if(p->tree.count > 1){
+		printw("with its %lu descendants - CPU: %.1f%%, RSS: %s",
+				p->tree.count - 1, p->tree.cpu / 100.0, format_kbytes(p->tree.rss));
+		if(globals.io){
+			printw(", read: %s/s", format_kbytes(p->tree.read / 1024));
+			printw(", write: %s/s", format_kbytes(p->tree.write / 1024));
+		}
+		printw("\n");
+	}
 
 	if(p->argv)
 		for(i = 0; p->argv[i]; i++)
@@ -646,16 +1032,17 @@ static void show_info(struct myproc *p, struct myproc **procs)
 }
 
 static void on_curproc(const char *fstr,
-		void (*f)(struct myproc *, struct myproc **),
-		int ask, struct myproc **procs)
+		void (*f)(struct myproc *, struct proctable *),
+		int ask, struct proctable *procs)
 {
 	struct myproc *p;
 
-	if(lock_proc_pid == -1 || !(p = proc_get(procs, lock_proc_pid))){
+	if(lock_proc.pid == -1 || !(p = proc_get_id(procs, &lock_proc))){
 		p = search_proc ? search_proc : curproc(procs);
 	}else{
 		STATUS(0, 0, "using locked process %d, \"%s\", any key to continue", p->pid, p->argv0_basename);
 		getch_delay(0);
+		gui_refresh();
 		getch();
 		getch_delay(1);
 	}
@@ -670,24 +1057,25 @@ static void on_curproc(const char *fstr,
 static void lock_to(struct myproc *p)
 {
 	if(p){
-		if(lock_proc_pid == p->pid){
+		if(lock_proc.pid == p->pid && lock_proc.starttime == p->starttime){
 			goto unlock;
 		}else{
-			lock_proc_pid = p->pid;
-			WAIT_STATUS("locked to process %d", lock_proc_pid);
+			lock_proc.pid = p->pid;
+			lock_proc.starttime = p->starttime;
+			WAIT_STATUS("locked to process %d", lock_proc.pid);
 		}
 	}else{
-		if(lock_proc_pid == -1){
+		if(lock_proc.pid == -1){
 			WAIT_STATUS("no process to lock to");
 		}else{
 unlock:
-			WAIT_STATUS("unlocked from process %d", lock_proc_pid);
-			lock_proc_pid = -1;
+			WAIT_STATUS("unlocked from process %d", lock_proc.pid);
+			lock_proc.pid = -1;
 		}
 	}
 }
 
-static void gui_search(int ch, struct myproc **procs)
+static void gui_search(int ch, struct proctable *procs)
 {
 	int do_lock = 0;
 
@@ -792,7 +1180,7 @@ backspace:
 		lock_to(search_proc);
 }
 
-static void refocus(struct myproc **procs)
+static void refocus(struct proctable *procs)
 {
 	if(current.pid == 0)
 		return;
@@ -811,33 +1199,91 @@ static void refocus(struct myproc **procs)
 	}
 }
 
-void gui_run(struct myproc **procs)
+/* carry the gui's state over to a newer snapshot */
+static void swap_to(struct snapshot *snap)
 {
-	struct sysinfo info;
-	long last_update = mstime() - WAIT_TIME - 1;
-	int fin = 0;
+	size_t i, n;
+
+	nfolds = proc_refold(snap->procs, folds, nfolds);
+	proc_sort(snap->procs, sort_by);
+
+	if(zoom.pid != -1 && !proc_get_id(snap->procs, &zoom)){
+		/* it's exited */
+		zoom.pid = -1;
+		collect_zoom(NULL);
+	}
+	proc_zoom(snap->procs, zoom.pid == -1 ? NULL : &zoom);
+
+	for(i = n = 0; i < nthreaded; i++)
+		if(proc_get_id(snap->procs, &threaded[i]))
+			threaded[n++] = threaded[i];
+	if(n != nthreaded){
+		nthreaded = n;
+		collect_threads(threaded, nthreaded);
+	}
+
+	if(search_proc){
+		const struct procid id = { search_proc->pid, search_proc->starttime };
+
+		search_proc = proc_get_id(snap->procs, &id);
+	}
+}
+
+/* sleep until there's a key, a snapshot or a resize */
+static void gui_wait(void)
+{
+	struct pollfd fds[] = {
+		{ .fd = STDIN_FILENO,  .events = POLLIN },
+		{ .fd = collect_fd(),  .events = POLLIN },
+		{ .fd = winch_fd,      .events = POLLIN },
+	};
+
+	gui_refresh();
+
+	/* EINTR is a resize, picked up by getch() */
+	if(poll(fds, winch_fd == -1 ? 2 : 3, -1) == -1)
+		return;
 
-	memset(&info, 0, sizeof info);
-	machine_init(&info);
-	proc_update(procs, &info);
+	if(fds[1].revents & POLLIN)
+		collect_ack();
+
+#ifdef __linux__
+	if(fds[2].revents & POLLIN){
+		struct signalfd_siginfo si;
+
+		while(read(winch_fd, &si, sizeof si) == sizeof si);
+		gui_resize();
+	}
+#endif
+}
+
+void gui_run(void)
+{
+	struct snapshot *snap = collect_init(WAIT_TIME);
+	struct proctable *procs = snap->procs;
+	int fin = 0;
 
 	do{
-		const long now = mstime();
+		struct snapshot *newer;
 		int ch;
 
-		if(!frozen && last_update + WAIT_TIME < now){
-			last_update = now;
-			proc_update(procs, &info);
+		if(!frozen && (newer = collect_take())){
+			swap_to(newer);
+			collect_give(snap);
+			snap = newer;
+			procs = snap->procs;
 			refocus(procs);
 		}
 
-		showprocs(procs, &info);
-
-		machine_update(&info);
+		showprocs(snap);
+		/* getch() would, but this way it's timed */
+		gui_refresh();
 
 		ch = getch();
-		if(ch == -1)
+		if(ch == ERR){
+			gui_wait();
 			continue;
+		}
 
 		if(search){
 			gui_search(ch, procs);
@@ -874,7 +1320,7 @@ void gui_run(struct myproc **procs)
 					position(0, procs);
 					break;
 				case SCROLL_TO_BOTTOM_CHAR:
-					position(info.count - (globals.kernel ? 0 : info.count_kernel), procs);
+					position(proc_row_count(procs) - 1, procs);
 					break;
 
 				case BACKWARD_HALF_WINDOW_CHAR:
@@ -891,7 +1337,7 @@ void gui_run(struct myproc **procs)
 					break;
 
 				case EXPOSE_ONE_MORE_LINE_BOTTOM_CHAR:
-					if(pos_top < info.count - 1){
+					if(pos_top < proc_row_count(procs) - 1){
 						pos_top++;
 						if(pos_y < pos_top){
 							pos_y = pos_top;
@@ -928,7 +1374,7 @@ void gui_run(struct myproc **procs)
 					break;
 
 				case 'z':
-					ch = getch();
+					ch = getch_wait(HALF_DELAY_TIME);
 					switch(ch){
 						case 't':
 							pos_top = pos_y;
@@ -952,8 +1398,13 @@ void gui_run(struct myproc **procs)
 
 				case REDRAW_CHAR:
 					/* redraw */
-					last_update = 0; /* force refresh */
-					clear();
+					collect_refresh(1);
+					gui_clear();
+					break;
+
+				case KEY_RESIZE:
+					/* ncurses has resized stdscr under us */
+					gui_clear();
 					break;
 
 				case LOCK_CHAR:
@@ -964,6 +1415,27 @@ void gui_run(struct myproc **procs)
 					frozen ^= 1;
 					break;
 
+				case CPU_TOGGLE_CHAR:
+					show_cpus ^= 1;
+					break;
+
+				case IO_TOGGLE_CHAR:
+					/* read by the collector */
+					__atomic_store_n(&globals.io, !globals.io, __ATOMIC_RELAXED);
+					collect_refresh(0);
+					break;
+
+				case MEM_SORT_CHAR:
+				{
+					/* the cursor stays with its process */
+					struct myproc *p = curproc(procs);
+
+					sort_by = sort_by == PROC_SORT_PID ? PROC_SORT_MEM : PROC_SORT_PID;
+					proc_sort(procs, sort_by);
+					goto_proc(procs, p);
+					break;
+				}
+
 				case BASENAME_TOGGLE_CHAR:
 					globals.basename ^= 1;
 					break;
@@ -986,11 +1458,23 @@ void gui_run(struct myproc **procs)
 					ps_from_file ^= 1;
 					break;
 
+				case THREADS_CHAR:
+				{
+					struct myproc *p = curproc(procs);
+					if(p)
+						toggle_threads(procs, p);
+					break;
+				}
+
+				case ZOOM_CHAR:
+					toggle_zoom(procs, curproc(procs));
+					break;
+
 				case FOLD_CHAR:
 				{
 					struct myproc *p = curproc(procs);
 					if(p)
-						p->folded ^= 1;
+						fold(procs, p, !p->folded);
 					break;
 				}
 
@@ -1000,4 +1484,6 @@ void gui_run(struct myproc **procs)
 			}
 		}
 	}while(!fin);
+
+	collect_term();
 }
@@ -3,6 +3,6 @@
 
 void gui_init(void);
 void gui_term(void);
-void gui_run(struct myproc **);
+void gui_run(void);
 
 #endif
@@ -9,6 +9,7 @@
 #include "structs.h"
 #include "proc.h"
 #include "main.h"
+#include "util.h"
 
 const char *machine_proc_display_line_default(struct myproc *p);
 int machine_proc_display_width_default(void);
@@ -60,18 +61,43 @@ void machine_update_unam_gnam(struct myproc *this, uid_t uid, uid_t gid)
 
 const char *machine_proc_display_line_default(struct myproc *p)
 {
-	static char buf[64];
+	static char buf[160];
+	char rss[16], pss[16], io[32] = "";
+
+	format_kbytes_r(p->memsize, rss, sizeof rss);
+	if(p->mem_detail)
+		format_kbytes_r(p->pss, pss, sizeof pss);
+	else
+		snprintf(pss, sizeof pss, "-");
+
+	if(globals.io && !p->io_known){
+		snprintf(io, sizeof io, "%6s %6s %6s ", "-", "-", "-");
+	}else if(globals.io){
+		/* read and written per second, then syscalls */
+		char rd[16], wr[16];
+		int n;
+
+		n = snprintf(io, sizeof io, "%6s %6s ",
+				format_kbytes_r(p->read_rate / 1024, rd, sizeof rd),
+				format_kbytes_r(p->write_rate / 1024, wr, sizeof wr));
+		snprintf(io + n, sizeof io - n, "%6.0f ", p->syscall_rate);
+	}
 
 	snprintf(buf, sizeof buf,
 			"% 11d %-1s " // 22
 			"%-*s %-*s "      // max_unam_len + max_gnam_len + 1
+			"%6s %6s "        // 14
+			"%s"              // 21, with globals.io
+			"%3d "            // 4
 #ifdef FLOAT_SUPPORT
 			"%3.1f"           // 5
 #endif
 			,
 			p->ppid, proc_state_str(p),
 			max_unam_len, p->unam,
-			max_gnam_len, p->gnam
+			max_gnam_len, p->gnam,
+			rss, pss, io,
+			p->last_cpu
 #ifdef FLOAT_SUPPORT
 			, p->pc_cpu
 #endif
@@ -82,7 +108,7 @@ const char *machine_proc_display_line_default(struct myproc *p)
 
 int machine_proc_display_width_default()
 {
-	return 11 + max_unam_len + max_gnam_len + 1 + 5;
+	return 11 + max_unam_len + max_gnam_len + 1 + 14 + (globals.io ? 21 : 0) + 4 + 5;
 }
 
 const char *uptime_from_boottime(time_t boottime)
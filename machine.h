@@ -3,8 +3,12 @@
 
 struct sysinfo;
 struct myproc;
+struct proctable;
 
 void machine_init(struct sysinfo *info);
+/* the backend, once, and info with it */
+void machine_info_init(struct sysinfo *info);
+/* another sysinfo, to be kept apart from the first by machine_update() */
 void machine_term(void);
 void machine_update(struct sysinfo *info);
 
@@ -12,12 +16,33 @@ const char *uptime_from_boottime(time_t boottime);
 const char *format_memory(int memory[6]);
 const char *format_cpu_pct(double *cpu_pct);
 
-int    machine_proc_exists(struct myproc *);
+pid_t *machine_proc_list(size_t *n);
+/* every pid currently on the system, in no particular order */
+pid_t *machine_proc_subtree(pid_t pid, size_t *n);
+/* pid and its descendants, in no particular order, or NULL if the
+ * backend can't find them without machine_proc_list() */
 
-int    machine_update_proc(struct myproc *proc);
-/* 0 on success, non-zero on error */
+struct myproc *machine_proc_new(pid_t pid);
+void machine_proc_free(struct myproc *);
 
-void machine_proc_get_more(struct myproc **);
+int    machine_update_proc(struct myproc *proc);
+/* 0 on success, MACHINE_PROC_REUSED if the pid now belongs to a different
+ * process, otherwise non-zero on error */
+#define MACHINE_PROC_REUSED 1
+
+void machine_update_batch(struct myproc **procs, size_t n);
+/* called with every process about to be passed to machine_update_proc(),
+ * so the backend may fetch them together */
+
+pid_t *machine_thread_list(pid_t pid, size_t *n);
+/* the threads of pid, in no particular order, or NULL if unknown */
+struct myproc *machine_thread_new(struct myproc *proc, pid_t tid);
+int machine_update_thread(struct myproc *thread);
+/* as machine_update_proc(), for a thread of thread->ppid */
+
+void machine_update_detail(struct myproc *proc);
+/* the costlier figures - pss, uss and swap - for the few processes on
+ * show, after their update. Called every update, the backend may cache */
 
 const char *machine_proc_display_line(struct myproc *p);
 int machine_proc_display_width(void);
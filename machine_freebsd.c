@@ -92,24 +92,12 @@ void getsysctl(const char *name, void *ptr, size_t len)
 #endif
 
 
-void machine_init(struct sysinfo *info)
+void machine_info_init(struct sysinfo *info)
 {
-	int pageshift;
-	int mib[2], pagesize, ncpus;
+	int mib[2], ncpus;
 	struct timeval boottime;
 	size_t bt_size;
 
-	/* get the page size and calculate pageshift from it */
-	pagesize = getpagesize();
-	pageshift = 0;
-	while (pagesize > 1) {
-		pageshift++;
-		pagesize >>= 1;
-	}
-
-	/* we only need the amount of log(2)1024 for our conversion */
-	pageshift -= LOG1024;
-
 	// Get the boottime from the kernel to calculate uptime
 	mib[0] = CTL_KERN;
 	mib[1] = KERN_BOOTTIME;
@@ -133,6 +121,25 @@ void machine_init(struct sysinfo *info)
 	//GETSYSCTL("kern.cp_time", info->cpu_cycles);
 
 	machine_update(info);
+}
+
+void machine_init(struct sysinfo *info)
+{
+	int pageshift;
+	int pagesize;
+
+	/* get the page size and calculate pageshift from it */
+	pagesize = getpagesize();
+	pageshift = 0;
+	while (pagesize > 1) {
+		pageshift++;
+		pagesize >>= 1;
+	}
+
+	/* we only need the amount of log(2)1024 for our conversion */
+	pageshift -= LOG1024;
+
+	machine_info_init(info);
 
 	// Finally, open kvm handle
 	//
@@ -292,39 +299,32 @@ const char *machine_proc_state_str(struct kinfo_proc *pp)
 #endif
 }
 
-int machine_proc_exists(struct myproc *p)
-{
-	int num_procs = 0;
-
-#ifdef __FreeBSD__
-	return !!kvm_getprocs(kd, KERN_PROC_PID, p->pid, &num_procs);
-#else
-	return !!kvm_getprocs2(kd, KERN_PROC_PID, p->pid, sizeof(struct kinfo_proc2), &num_procs);
-#endif
-}
-
 /* Update process fields. */
-void argv_dup(struct myproc *proc, char **argv)
+static void argv_dup(struct myproc *proc, char **argv)
 {
-	int n;
-	char **i, **ret;
+	char *args = NULL;
+	size_t len = 0;
+	char **i;
 
-	for(i = argv, n = 0; i && *i; i++, n++);
-
-	if(!n){
+	if(!argv || !*argv){
+		free(proc->argv);
 		proc->argv = NULL;
 		proc->argc = 0;
+		proc->shell_cmd = proc->argv0_basename = NULL;
 		return;
 	}
 
-	ret = umalloc((n + 1) * sizeof *ret);
+	/* join into nul-separated arguments, as proc_set_argv() wants */
+	for(i = argv; *i; i++){
+		size_t n = strlen(*i) + 1;
 
-	for(i = argv, n = 0; *i; i++, n++)
-		ret[n] = ustrdup(argv[n]);
-	ret[n] = NULL;
+		args = urealloc(args, len + n);
+		memcpy(args + len, *i, n);
+		len += n;
+	}
 
-	proc->argv = ret;
-	proc->argc = n;
+	proc_set_argv(proc, args, len);
+	free(args);
 }
 
 /* Returns 0 on success, -1 on error */
@@ -397,23 +397,30 @@ int machine_update_proc(struct myproc *proc)
 		argv = kvm_getargv(kd, pp, 0);
 #endif
 
-		argv_free(proc->argc, proc->argv);
-
 		argv_dup(proc, argv);
 
-		proc_create_shell_cmd(proc);
-
 		return 0;
 	} else {
 		return -1;
 	}
 }
 
-struct myproc *machine_proc_new(struct kinfo_proc *pp)
+struct myproc *machine_proc_new(pid_t pid)
 {
 	struct myproc *this = NULL;
+	struct kinfo_proc *pp;
+	int n = 0;
+
+#ifdef __NetBSD__
+	pp = kvm_getprocs2(kd, KERN_PROC_PID, pid, sizeof(*pp), &n);
+#else
+	pp = kvm_getprocs(kd, KERN_PROC_PID, pid, &n);
+#endif
 
-	this = umalloc(sizeof(*this));
+	if(!pp)
+		return NULL;
+
+	this = proc_alloc();
 
 #if 0
 	this->basename = ustrdup(pp->ki_comm);
@@ -447,6 +454,49 @@ struct myproc *machine_proc_new(struct kinfo_proc *pp)
 	return this;
 }
 
+void machine_update_batch(struct myproc **procs, size_t n)
+{
+	(void)procs;
+	(void)n;
+}
+
+void machine_update_detail(struct myproc *p)
+{
+	(void)p;
+}
+
+pid_t *machine_proc_subtree(pid_t pid, size_t *n)
+{
+	(void)pid;
+	(void)n;
+	return NULL;
+}
+
+pid_t *machine_thread_list(pid_t pid, size_t *n)
+{
+	(void)pid;
+	(void)n;
+	return NULL;
+}
+
+struct myproc *machine_thread_new(struct myproc *proc, pid_t tid)
+{
+	(void)proc;
+	(void)tid;
+	return NULL;
+}
+
+int machine_update_thread(struct myproc *thread)
+{
+	(void)thread;
+	return -1;
+}
+
+void machine_proc_free(struct myproc *p)
+{
+	(void)p;
+}
+
 const char *machine_proc_display_line(struct myproc *p)
 {
 	// similar to linux, except with jid - TODO
@@ -471,8 +521,10 @@ int machine_proc_display_width()
 	return 11 + max_unam_len + max_gnam_len + 1 + 5;
 }
 
-void machine_proc_get_more(struct myproc **procs)
+pid_t *machine_proc_list(size_t *pn)
 {
+	static pid_t *pids;
+	size_t n = 0;
 	int num_procs = 0;
 
 	struct kinfo_proc *pbase; /* defined in /usr/include/sys/user.h */
@@ -487,10 +539,9 @@ void machine_proc_get_more(struct myproc **procs)
 		struct kinfo_proc *pp;
 		int i;
 
-		/*
-		 * iterate over each kinfo_struct pointer and check if it
-		 * exists already in our hash table. If it is not present, add it
-		 */
+		pids = urealloc(pids, (num_procs ? num_procs : 1) * sizeof *pids);
+
+		/* iterate over each kinfo_struct pointer and collect its pid */
 		for(pp = pbase, i = 0; i < num_procs; pp++, i++){
 #ifdef __NetBSD__
 #  define FLAGS pp->p_tdflags
@@ -502,28 +553,26 @@ void machine_proc_get_more(struct myproc **procs)
 #  define FLAG  pp->ki_flag
 #endif
 
-			if(!proc_get(procs, PID)){
-				struct myproc *p = machine_proc_new(pp);
-
 #ifdef BSD_TODO
-				if(!show_kidle && FLAGS & TDF_IDLETD)
-					continue; /* skip kernel idle process */
+			if(!show_kidle && FLAGS & TDF_IDLETD)
+				continue; /* skip kernel idle process */
 
-				if(pp->ki_stat == 0)
-					continue; /* not in use */
+			if(pp->ki_stat == 0)
+				continue; /* not in use */
 
-				if (!show_self && PID == sel->self)
-					continue; /* skip self */
+			if (!show_self && PID == sel->self)
+				continue; /* skip self */
 
-				if (!show_system && (FLAG & P_SYSTEM))
-					continue; /* skip system process */
+			if (!show_system && (FLAG & P_SYSTEM))
+				continue; /* skip system process */
 #endif
 
-				if(p)
-					proc_addto(procs, p);
-			}
+			pids[n++] = PID;
 		}
 	}
+
+	*pn = n;
+	return pids;
 }
 
 const char *machine_format_memory(struct sysinfo *info)
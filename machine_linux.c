@@ -7,18 +7,30 @@
 #include <sys/types.h>
 #include <sys/stat.h> // S_IFCHR
 #include <sys/file.h> // O_RDONLY
+#include <sys/resource.h>
+#include <fcntl.h>
 #include <time.h>
 #include <dirent.h>
 #include <ctype.h>
 
 #include "util.h"
+#include "pool.h"
 #include "proc.h"
 #include "machine.h"
 #include "main.h"
 #include "structs.h"
 
-#define STAT_PATH(buf, pid) \
-	snprintf(buf, sizeof buf, "/proc/%d/stat", pid);
+/* descriptors left over for everything else */
+#define FD_RESERVE 64
+
+/* big enough for any /proc/$pid/stat */
+#define STAT_BUF 1024
+
+/* big enough for any /proc/$pid/io */
+#define IO_BUF 512
+
+/* how often a process on show has its smaps_rollup re-read */
+#define DETAIL_US (5 * 1000000ULL)
 
 /* needed for tty device id */
 #ifndef minor
@@ -31,7 +43,226 @@ const char *memorynames[] = {
 	"Free", NULL
 };
 
+/* as enum cpu_state - guest time is already counted in user and nice */
+static const char *cpunames[CPU_NSTATES] = {
+	"user", "nice", "sys", "idle", "iowait", "irq", "softirq", "steal",
+};
+
+/* /proc/stat is kept open and re-read from the start into stat_buf. The
+ * last sample of each of its cpu lines is kept for the differences */
+static int stat_fd = -1;
+static char *stat_buf;
+static size_t stat_buf_max;
+static unsigned long long cpu_last[CPU_NSTATES];
+static unsigned long long (*cpu_last_each)[CPU_NSTATES];
+static size_t cpu_last_n;
+
+/* when processes were last read, and whether their io with them */
+static unsigned long long sample_us;
+static int read_io;
+static long clk_tck, ncpus_online, page_kb;
+
+/* PSS, USS and swap, from smaps_rollup - the kernel walks every mapping
+ * to sum them, so they're only read for the processes on show, see
+ * machine_update_detail(). Kept here by identity rather than in myproc,
+ * as each of the collector's tables has its own copy of a process */
+static struct detail
+{
+	struct procid id;
+	unsigned long long read; /* sample_us when read, 0 if never */
+	unsigned long pss, uss, swap;
+	int ok; /* 0 if unreadable - someone else's */
+} *details;
+static size_t ndetails, details_max;
+
+/* /proc is opened once, and everything under it opened relative to that.
+ * Each process's stat file is kept open between updates and re-read with
+ * pread(). The descriptors are kept here by identity, as the details are,
+ * so the collector's two tables share one per process, within a budget
+ * under RLIMIT_NOFILE - past that, the one least recently read is closed.
+ * One read by neither table for a couple of updates has exited, and goes.
+ */
+static DIR *proc_dir;
+
+static struct statfd
+{
+	struct procid id; /* starttime 0 until read through fd */
+	int fd;
+	unsigned long update; /* fd_update when last read */
+	struct statfd *next; /* in its bucket */
+	struct statfd *lru_prev, *lru_next;
+} **statfds; /* hashed by pid */
+static size_t nbuckets; /* a power of 2 */
+static struct statfd *fd_lru_head, *fd_lru_tail; /* most recent first */
+static size_t fds_open, fds_max;
+static unsigned long fd_update;
+
+static struct slab statfd_slab = {
+	.objsz = sizeof(struct statfd),
+	.per_chunk = 256,
+};
+
+static int procfs_fd(void)
+{
+	if(!proc_dir){
+		struct rlimit rl;
+
+		if(!(proc_dir = opendir("/proc"))){
+			perror("opendir()");
+			exit(1);
+		}
+
+		if(getrlimit(RLIMIT_NOFILE, &rl))
+			fds_max = 0;
+		else if(rl.rlim_cur == RLIM_INFINITY)
+			fds_max = 1 << 20;
+		else
+			fds_max = rl.rlim_cur > 2 * FD_RESERVE ? rl.rlim_cur - FD_RESERVE : 0;
+	}
+
+	return dirfd(proc_dir);
+}
+
+static int procfs_open(pid_t pid, const char *file)
+{
+	char path[32];
+
+	snprintf(path, sizeof path, "%d/%s", pid, file);
+
+	return openat(procfs_fd(), path, O_RDONLY | O_CLOEXEC);
+}
+
+/* pid's descriptor, if held. Safe from the pool, as nothing changes the
+ * map during pool_run() */
+static struct statfd *statfd_find(pid_t pid)
+{
+	struct statfd *e;
+
+	if(!nbuckets)
+		return NULL;
+
+	for(e = statfds[pid & (nbuckets - 1)]; e; e = e->next)
+		if(e->id.pid == pid)
+			return e;
+	return NULL;
+}
+
+static void statfds_grow(void)
+{
+	struct statfd **old = statfds;
+	const size_t nold = nbuckets;
+	size_t i;
+
+	nbuckets = nbuckets ? nbuckets * 2 : 256;
+	statfds = umalloc(nbuckets * sizeof *statfds);
+	memset(statfds, 0, nbuckets * sizeof *statfds);
+
+	for(i = 0; i < nold; i++){
+		struct statfd *e, *next;
+
+		for(e = old[i]; e; e = next){
+			struct statfd **head = &statfds[e->id.pid & (nbuckets - 1)];
+
+			next = e->next;
+			e->next = *head;
+			*head = e;
+		}
+	}
+	free(old);
+}
+
+static void fd_lru_unlink(struct statfd *e)
+{
+	if(e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		fd_lru_head = e->lru_next;
+
+	if(e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		fd_lru_tail = e->lru_prev;
+
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void fd_lru_push(struct statfd *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = fd_lru_head;
+
+	if(fd_lru_head)
+		fd_lru_head->lru_prev = e;
+	else
+		fd_lru_tail = e;
+	fd_lru_head = e;
+}
+
+/* e has just been read */
+static void fd_lru_touch(struct statfd *e)
+{
+	e->update = fd_update;
+	fd_lru_unlink(e);
+	fd_lru_push(e);
+}
+
+static void fd_close(struct statfd *e)
+{
+	struct statfd **pp = &statfds[e->id.pid & (nbuckets - 1)];
+
+	while(*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+
+	fd_lru_unlink(e);
+	close(e->fd);
+	fds_open--;
+	slab_free(&statfd_slab, e);
+}
+
+/* hang on to fd for pid, if the budget allows. The entry, or NULL */
+static struct statfd *fd_keep(pid_t pid, int fd)
+{
+	struct statfd **head, *e;
+
+	if(fds_max == 0)
+		return NULL;
+
+	if(fds_open >= fds_max)
+		fd_close(fd_lru_tail);
+	if(fds_open >= nbuckets)
+		statfds_grow();
+
+	e = slab_alloc(&statfd_slab);
+	e->id.pid = pid;
+	e->fd = fd;
+	e->update = fd_update;
+
+	head = &statfds[pid & (nbuckets - 1)];
+	e->next = *head;
+	*head = e;
+
+	fd_lru_push(e);
+	fds_open++;
+	return e;
+}
+
 void machine_init(struct sysinfo *info)
+{
+	clk_tck = sysconf(_SC_CLK_TCK);
+	ncpus_online = sysconf(_SC_NPROCESSORS_ONLN);
+	page_kb = sysconf(_SC_PAGESIZE) / 1024;
+	if(page_kb <= 0)
+		page_kb = 4;
+	if(clk_tck <= 0)
+		clk_tck = 100;
+	if(ncpus_online <= 0)
+		ncpus_online = 1;
+
+	machine_info_init(info);
+}
+
+void machine_info_init(struct sysinfo *info)
 {
 	// get uptime and calculate bootime from it
 	FILE *f;
@@ -59,6 +290,15 @@ void machine_init(struct sysinfo *info)
 
 void machine_term()
 {
+	if(stat_fd != -1)
+		close(stat_fd);
+	free(details);
+
+	while(fd_lru_tail)
+		fd_close(fd_lru_tail);
+	free(statfds);
+	statfds = NULL;
+	nbuckets = 0;
 }
 
 static void get_load_average(struct sysinfo *info)
@@ -81,8 +321,8 @@ static void get_load_average(struct sysinfo *info)
 			}
 			break;
 		}
+		fclose(f);
 	}
-	fclose(f);
 #else
 	(void)info;
 #endif
@@ -144,14 +384,115 @@ Key:     val kB
 				}
 			}
 		}
+		fclose(f);
 	}
-	fclose(f);
+}
+
+/* pm: per mille of the time from last to now in each state. last = now */
+static void cpu_diff(const unsigned long long *now, unsigned long long *last, unsigned short *pm)
+{
+	unsigned long long diff[CPU_NSTATES], total = 0;
+	int i;
+
+	for(i = 0; i < CPU_NSTATES; i++){
+		/* the counters can step back a little on cpu hotplug */
+		diff[i] = now[i] > last[i] ? now[i] - last[i] : 0;
+		total += diff[i];
+	}
+
+	for(i = 0; i < CPU_NSTATES; i++){
+		pm[i] = total ? (diff[i] * 1000 + total / 2) / total : 0;
+		last[i] = now[i];
+	}
+}
+
+/* the whole of /proc/stat, in stat_buf, nul terminated */
+static ssize_t stat_file(void)
+{
+	ssize_t len;
+
+	if(stat_fd == -1 && (stat_fd = openat(procfs_fd(), "stat", O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+
+	for(;;){
+		if(stat_buf_max == 0){
+			stat_buf_max = 4096;
+			stat_buf = urealloc(stat_buf, stat_buf_max);
+		}
+
+		if((len = pread(stat_fd, stat_buf, stat_buf_max - 1, 0)) < 0)
+			return -1;
+
+		if((size_t)len < stat_buf_max - 1)
+			break;
+
+		stat_buf_max *= 2;
+		stat_buf = urealloc(stat_buf, stat_buf_max);
+	}
+
+	stat_buf[len] = '\0';
+	return len;
 }
 
 static void get_cpu_stats(struct sysinfo *info)
 {
-	// TODO
-	(void)info;
+	const char *line;
+	size_t ncpus = 0;
+
+	if(stat_file() < 0)
+		return;
+
+	if(info->ncpus > 0)
+		memset(info->cpu_each, 0, info->ncpus * sizeof *info->cpu_each);
+
+	/* the cpu lines come first: "cpu" for the total, then "cpuN" */
+	for(line = stat_buf; !strncmp(line, "cpu", 3); ){
+		unsigned long long now[CPU_NSTATES] = { 0 };
+		const char *nl;
+		char *p = (char *)line + 3;
+		size_t cpu = 0;
+		int total = *p == ' ';
+		int i;
+
+		if(!total)
+			cpu = strtoul(p, &p, 10);
+
+		/* older kernels have fewer states, the rest stay 0 */
+		for(i = 0; i < CPU_NSTATES && *p == ' '; i++)
+			now[i] = strtoull(p, &p, 10);
+
+		if(total){
+			cpu_diff(now, cpu_last, info->cpu_states);
+		}else{
+			if(cpu >= cpu_last_n){
+				const size_t n = cpu_last_n;
+
+				cpu_last_n = cpu + 1;
+				cpu_last_each = urealloc(cpu_last_each, cpu_last_n * sizeof *cpu_last_each);
+				memset(cpu_last_each + n, 0, (cpu_last_n - n) * sizeof *cpu_last_each);
+			}
+
+			if(cpu >= (size_t)info->ncpus){
+				const size_t n = info->ncpus;
+
+				info->ncpus = cpu + 1;
+				info->cpu_each = urealloc(info->cpu_each, info->ncpus * sizeof *info->cpu_each);
+				memset(info->cpu_each + n, 0, (info->ncpus - n) * sizeof *info->cpu_each);
+			}
+
+			cpu_diff(now, cpu_last_each[cpu], info->cpu_each[cpu]);
+			if(cpu + 1 > ncpus)
+				ncpus = cpu + 1;
+		}
+
+		if(!(nl = strchr(line, '\n')))
+			break;
+		line = nl + 1;
+	}
+
+	/* cpus at the end went offline */
+	if(ncpus)
+		info->ncpus = ncpus;
 }
 
 void machine_update(struct sysinfo *info)
@@ -161,198 +502,746 @@ void machine_update(struct sysinfo *info)
 	get_cpu_stats(info);
 }
 
-int machine_proc_exists(struct myproc *p)
+/* the whole of /proc/$pid/$file, allocated */
+static char *procfs_read(pid_t pid, const char *file, size_t *plen)
 {
-	char buf[64];
-	snprintf(buf, sizeof buf, "/proc/%d", p->pid);
-	return access(buf, F_OK) == 0;
+	char *buf = NULL;
+	size_t len = 0, max = 0;
+	ssize_t n;
+	int fd;
+
+	if((fd = procfs_open(pid, file)) == -1)
+		return NULL;
+
+	for(;;){
+		if(len == max){
+			max += 512;
+			buf = urealloc(buf, max);
+		}
+
+		if((n = read(fd, buf + len, max - len)) <= 0)
+			break;
+		len += n;
+	}
+
+	close(fd);
+
+	if(n < 0){
+		/* process exited while we were reading */
+		free(buf);
+		return NULL;
+	}
+
+	*plen = len;
+	return buf;
 }
 
-static void machine_read_argv(struct myproc *p)
+/* command lines rarely change after exec(), which renames comm */
+static int argv_wanted(struct myproc *p, const char *comm)
 {
-	// cmdline
-	char path[64];
-	char *cmd = NULL;
-	int len;
+	return !p->argv || p->argv_stale || strcmp(comm, p->comm);
+}
 
-	snprintf(path, sizeof path, "/proc/%d/cmdline", p->pid);
+/* cmd: the command line if already read, or NULL. Freed here */
+static void machine_read_argv(struct myproc *p, char *cmd, size_t len)
+{
+	if(!cmd)
+		cmd = procfs_read(p->pid, "cmdline", &len);
 
-	if(fline(path, &cmd, &len) && len){
-		int i, nuls;
-		char *last, *pos;
+	if(cmd && len){
+		proc_set_argv(p, cmd, len);
+	}else{
+		/* no cmdline (kernel thread or zombie), use the name from $pid/stat */
+		proc_set_argv(p, p->comm, strlen(p->comm));
+	}
 
-		for(i = nuls = 0; i < len; i++)
-			if(cmd[i] == '\0')
-				nuls++;
+	free(cmd);
+	p->argv_stale = 0;
+}
 
-		if(len && nuls == 0){
-			/* rewritten and there are no nuls */
-			cmd = urealloc(cmd, ++len);
-			cmd[len-1] = '\0';
-			nuls++;
-		}
+/* the fields we want from /proc/$pid/stat */
+struct stat_line
+{
+	char comm[32];
+	char state;
+	pid_t ppid, pgrp;
+	int tty;
+	unsigned long utime, stime, cutime, cstime;
+	long nice;
+	unsigned long long starttime;
+	long rss; /* pages */
+	int processor; /* last run on */
+};
 
-		argv_free(p->argc, p->argv);
+/* Single pass over a stat line - "pid (comm) S 1 2 3 ..." - comm can
+ * contain spaces and parens, so the fields start after the last ')'.
+ * Returns 0 on success. */
+static int stat_parse(const char *buf, size_t len, struct stat_line *st)
+{
+	const char *const end = buf + len;
+	const char *s, *comm;
+	size_t n;
+	int i;
 
-		p->argc = nuls;
-		p->argv = umalloc((p->argc + 1) * sizeof *p->argv);
+	if(!(comm = memchr(buf, '(', len)))
+		return -1;
+	comm++;
 
-		for(i = nuls = 0, last = cmd; i < len; i++){
-			// nuls is the argv index
-			if(cmd[i] == '\0'){
-				p->argv[nuls++] = ustrdup(last);
-				last = cmd + i + 1;
-			}
+	for(s = end - 1; s > comm && *s != ')'; s--);
+	if(s == comm && *s != ')')
+		return -1;
+
+	n = s - comm;
+	if(n >= sizeof st->comm)
+		n = sizeof st->comm - 1;
+	memcpy(st->comm, comm, n);
+	st->comm[n] = '\0';
+
+	/* NOTE: index numbers are zero-based on the first entry after "(process name)" */
+	for(s += 2, i = 0; s < end && i <= 36; i++){
+		unsigned long long v = 0;
+		int neg = 0;
+
+		if(i == 0){
+			st->state = *s;
+		}else{
+			if(*s == '-')
+				neg = 1, s++;
+			for(; s < end && '0' <= *s && *s <= '9'; s++)
+				v = v * 10 + (*s - '0');
+			if(neg)
+				v = -v;
 		}
-		p->argv[p->argc] = NULL;
-
-		if(p->argv[0]){
-			if((pos = strchr(p->argv[0], ':'))){
-				/* sshd: ... */
-				p->argv0_basename = p->argv[0];
-			}else{
-				pos = strrchr(p->argv[0], '/'); /* locate the last '/' in argv[0], which is the full command path */
-
-				/* malloc in just a second.. */
-				if(!pos++)
-					pos = p->argv[0];
-				p->argv0_basename = pos;
-			}
+
+		switch(i){
+			case 1:  st->ppid      = v; break;
+			case 2:  st->pgrp      = v; break;
+			case 4:  st->tty       = v; break;
+			case 11: st->utime     = v; break;
+			case 12: st->stime     = v; break;
+			case 13: st->cutime    = v; break;
+			case 14: st->cstime    = v; break;
+			case 16: st->nice      = v; break;
+			case 19: st->starttime = v; break;
+			case 21: st->rss       = v; break;
+			case 36: st->processor = v; break;
 		}
-	}else{
-		free(cmd);
-		cmd = NULL;
 
-		/* no cmdline, get argv from $pid/stat */
-		STAT_PATH(path, p->pid);
+		while(s < end && *s != ' ')
+			s++;
+		s++;
+	}
 
-		if(fline(path, &cmd, NULL)){
-			char *end, *start;
+	return i > 36 ? 0 : -1;
+}
 
-			start = strchr(cmd, '(');
-			if(!start)
-				goto fin;
+/* the fields we want from /proc/$pid/io */
+struct io_line
+{
+	unsigned long long read_bytes, write_bytes, syscr, syscw;
+};
 
-			end = strchr(start + 1, ')');
-			if(!end)
-				goto fin;
+/* "syscr: 1234" lines, any order. Returns 0 on success */
+static int io_parse(char *buf, size_t len, struct io_line *io)
+{
+	char *s = buf;
+	int found = 0;
 
-			argv_free(p->argc, p->argv);
+	if(len >= IO_BUF)
+		return -1;
+	buf[len] = '\0';
 
-			p->argc = 1;
-			p->argv = umalloc(2 * sizeof *p->argv);
+	while(s){
+		const char *val = strchr(s, ':');
 
-			*end = '\0';
-			p->argv[0] = ustrdup(start + 1);
-		}
+		if(!val)
+			break;
+		val++;
+
+		if(!strncmp(s, "syscr:", 6))
+			io->syscr = strtoull(val, NULL, 10), found++;
+		else if(!strncmp(s, "syscw:", 6))
+			io->syscw = strtoull(val, NULL, 10), found++;
+		else if(!strncmp(s, "read_bytes:", 11))
+			io->read_bytes = strtoull(val, NULL, 10), found++;
+		else if(!strncmp(s, "write_bytes:", 12))
+			io->write_bytes = strtoull(val, NULL, 10), found++;
+
+		if((s = strchr(val, '\n')))
+			s++;
 	}
 
-fin:
-	free(cmd);
+	return found == 4 ? 0 : -1;
 }
 
-int machine_update_proc(struct myproc *proc)
+/* /proc/$pid/io, parsed. Other users' are refused (by open or read,
+ * depending on the kernel), which is remembered rather than retried.
+ * Returns 0 on success */
+static int io_read(struct myproc *p, struct io_line *io)
 {
-	char *buf;
-	char path[64];
+	char buf[IO_BUF];
+	ssize_t n = -1;
+	int fd;
 
-	STAT_PATH(path, proc->pid);
+	if(p->machine.procfs.io_denied)
+		return -1;
 
-	if(fline(path, &buf, NULL)){
-		int i;
-		char *start = strrchr(buf, ')') + 2;
-		char *iter;
-		int ttyn = -1;
-
-		i = 0;
-		for(iter = strtok(start, " \t"); iter; iter = strtok(NULL, " \t")){
-			switch(i++){
-				/* NOTE: index numbers are zero-based on the first entry after "(process name)" */
-				case 0:
-					{
-						/* state: convert to PROC_STATE */
-						char c;
-						if(sscanf(iter, "%c", &c) == 1)
-							proc->state = proc_state_parse(c);
-						break;
-					}
-
-#define INT(n, fmt, x) case n: sscanf(iter, fmt, x); break
-					INT(1,  "%d", &proc->ppid);
-					INT(4,  "%d", &ttyn);
-					INT(5,  "%u", &proc->pgrp);
-
-					INT(11, "%lu", &proc->utime);
-					INT(12, "%lu", &proc->stime);
-					INT(13, "%lu", &proc->cutime);
-					INT(14, "%lu", &proc->cstime);
-#undef INT
-			}
+	if((fd = procfs_open(p->pid, "io")) != -1){
+		n = read(fd, buf, sizeof buf - 1);
+		close(fd);
+	}
+
+	if(n < 0){
+		if(errno == EACCES || errno == EPERM)
+			p->machine.procfs.io_denied = 1;
+		return -1;
+	}
+
+	return io_parse(buf, n, io);
+}
+
+/* one read of /proc/$pid/stat, into buf. *pe is pid's descriptor, or
+ * NULL, and is updated to match */
+static ssize_t stat_read(pid_t pid, struct statfd **pe, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	if(*pe){
+		if((n = pread((*pe)->fd, buf, len, 0)) > 0){
+			fd_lru_touch(*pe);
+			return n;
 		}
-		free(buf);
 
-		if(ttyn != -1){
-			char ttybuf[16];
-			snprintf(ttybuf, sizeof ttybuf, "pts/%d", minor(ttyn));
+		/* stale - the process has gone, maybe its pid reused */
+		fd_close(*pe);
+		*pe = NULL;
+	}
+
+	if((fd = procfs_open(pid, "stat")) == -1)
+		return -1;
+
+	if((n = pread(fd, buf, len, 0)) <= 0 || !(*pe = fd_keep(pid, fd)))
+		close(fd);
+
+	return n;
+}
+
+/* read ahead of machine_update_proc(), by machine_update_batch() */
+struct readahead
+{
+	struct stat_line st;
+	char *cmd; /* if the command line wanted re-reading */
+	size_t cmdlen;
+	struct io_line io;
+	signed char io_ok; /* 1 read, 0 couldn't be, -1 left to machine_update_proc() */
+};
+static struct readahead *ahead;
+static size_t ahead_max;
+
+/* one process's share of the threaded read-ahead */
+static void batch_read(size_t i, void *ctx)
+{
+	struct myproc *p = ((struct myproc **)ctx)[i];
+	struct readahead *ra = &ahead[i];
+	const struct statfd *e;
+	char buf[STAT_BUF];
+	ssize_t n;
+
+	/* no opening here - the descriptors are left to the serial path */
+	if(!(e = statfd_find(p->pid)))
+		return;
+
+	if((n = pread(e->fd, buf, sizeof buf, 0)) <= 0
+	|| stat_parse(buf, n, &ra->st))
+	{
+		return;
+	}
+
+	ra->cmd = NULL;
+	if(argv_wanted(p, ra->st.comm))
+		ra->cmd = procfs_read(p->pid, "cmdline", &ra->cmdlen);
+
+	ra->io_ok = -1;
+	if(read_io)
+		ra->io_ok = io_read(p, &ra->io) == 0;
+
+	p->machine.procfs.batch = i + 1;
+}
+
+void machine_update_batch(struct myproc **procs, size_t n)
+{
+	struct timespec ts;
+
+	/* for cpu%, the reads below all count as now */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sample_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	read_io = __atomic_load_n(&globals.io, __ATOMIC_RELAXED);
+
+	/* read by neither table since the update before last */
+	fd_update++;
+	while(fd_lru_tail && fd_update - fd_lru_tail->update > 2)
+		fd_close(fd_lru_tail);
+
+	if(pool_size() <= 1)
+		return;
+
+	if(ahead_max < n){
+		ahead_max = n;
+		ahead = urealloc(ahead, ahead_max * sizeof *ahead);
+	}
+
+	pool_run(n, batch_read, procs);
+}
+
+/* cpu% since the last sample, from ticks, the new utime + stime. As in top,
+ * 100% is one cpu */
+static void proc_cpu(struct myproc *proc, unsigned long ticks)
+{
+	const unsigned long long last = proc->machine.procfs.sampled;
+	const unsigned long prev = proc->utime + proc->stime;
+
+	if(last && sample_us > last){
+		double pc = (ticks > prev ? ticks - prev : 0)
+			* 100.0 / clk_tck * 1e6 / (sample_us - last);
+
+		/* tick granularity can push a short interval over */
+		if(pc > 100.0 * ncpus_online)
+			pc = 100.0 * ncpus_online;
+		proc->pc_cpu = pc;
+	}
+
+	proc->cputime = ticks / clk_tck;
+	proc->machine.procfs.sampled = sample_us;
+}
+
+/* rates since the last sample, or unknown if this one's missing */
+static void proc_io(struct myproc *proc, const struct io_line *io)
+{
+	const unsigned long long last = proc->machine.procfs.io_sampled;
+
+#define DELTA(now, prev) ((now) > (prev) ? (now) - (prev) : 0)
+	if(io && last && sample_us > last){
+		const double secs = (sample_us - last) / 1e6;
+
+		proc->read_rate    = DELTA(io->read_bytes, proc->read_bytes) / secs;
+		proc->write_rate   = DELTA(io->write_bytes, proc->write_bytes) / secs;
+		proc->syscall_rate = (DELTA(io->syscr, proc->syscr)
+				+ DELTA(io->syscw, proc->syscw)) / secs;
+		proc->io_known = 1;
+	}else{
+		proc->io_known = 0;
+	}
+#undef DELTA
+
+	if(io){
+		proc->read_bytes  = io->read_bytes;
+		proc->write_bytes = io->write_bytes;
+		proc->syscr       = io->syscr;
+		proc->syscw       = io->syscw;
+	}
+	proc->machine.procfs.io_sampled = io ? sample_us : 0;
+}
+
+int machine_update_proc(struct myproc *proc)
+{
+	struct statfd *e = statfd_find(proc->pid);
+	char buf[STAT_BUF];
+	struct stat_line st;
+	struct io_line io;
+	char *cmd = NULL;
+	size_t cmdlen = 0;
+	ssize_t len;
+	int reread_argv, io_ok = -1;
+
+	if(proc->machine.procfs.batch){
+		const struct readahead *ra = &ahead[proc->machine.procfs.batch - 1];
+
+		st = ra->st;
+		cmd = ra->cmd;
+		cmdlen = ra->cmdlen;
+		io = ra->io;
+		io_ok = ra->io_ok;
+		proc->machine.procfs.batch = 0;
+
+		/* the batch may have had its descriptor taken since */
+		if(e)
+			fd_lru_touch(e);
+
+	}else if(e && proc->argv && e->id.starttime && e->id.starttime != proc->starttime){
+		/* the other table has already found the pid reused */
+		return MACHINE_PROC_REUSED;
+
+	}else if((len = stat_read(proc->pid, &e, buf, sizeof buf)) <= 0
+	|| stat_parse(buf, len, &st))
+	{
+		return -1;
+	}
+
+	if(e)
+		e->id.starttime = st.starttime;
+
+	/* the start time tells a recycled pid apart */
+	if(proc->argv && st.starttime != proc->starttime){
+		free(cmd);
+		return MACHINE_PROC_REUSED;
+	}
+	proc->starttime = st.starttime;
+
+	proc->state  = proc_state_parse(st.state);
+	proc->ppid   = st.ppid;
+	proc->pgrp   = st.pgrp;
+	proc->nice   = st.nice;
+	proc_cpu(proc, st.utime + st.stime);
+	proc->utime  = st.utime;
+	proc->stime  = st.stime;
+	proc->cutime = st.cutime;
+	proc->cstime = st.cstime;
+	proc->memsize = st.rss > 0 ? st.rss * page_kb : 0;
+	proc->last_cpu = st.processor;
+
+	if(read_io && io_ok == -1)
+		io_ok = io_read(proc, &io) == 0;
+	proc_io(proc, io_ok == 1 ? &io : NULL);
+
+	if(st.tty){
+		char ttybuf[16];
+		snprintf(ttybuf, sizeof ttybuf, "pts/%d", minor(st.tty));
+		if(!proc->tty || strcmp(proc->tty, ttybuf)){
+			free(proc->tty);
 			proc->tty = ustrdup(ttybuf);
 		}
+	}
+
+	reread_argv = argv_wanted(proc, st.comm);
+	memcpy(proc->comm, st.comm, sizeof proc->comm);
+
+	if(reread_argv)
+		machine_read_argv(proc, cmd, cmdlen);
+	else
+		free(cmd);
+	return 0;
+}
 
-		machine_read_argv(proc);
+/* d's figures, 0 if the file can't be read */
+static int detail_read(pid_t pid, struct detail *d)
+{
+	char *buf, *s, *end;
+	size_t len;
+
+	if(!(buf = procfs_read(pid, "smaps_rollup", &len)))
 		return 0;
-	}else{
-		return -1;
+	buf[len] = '\0'; /* procfs_read() always leaves room */
+
+	/* "Pss:     1234 kB" - uss is the sum of the Private_* lines */
+	d->pss = d->uss = d->swap = 0;
+	for(s = buf, end = buf + len; s < end; s++){
+		const char *val = strchr(s, ':');
+
+		if(!val)
+			break;
+		val++;
+
+		if(!strncmp(s, "Pss:", 4))
+			d->pss = strtoul(val, NULL, 10);
+		else if(!strncmp(s, "Private_", 8))
+			d->uss += strtoul(val, NULL, 10);
+		else if(!strncmp(s, "Swap:", 5))
+			d->swap = strtoul(val, NULL, 10);
+
+		if(!(s = strchr(val, '\n')))
+			break;
 	}
+
+	free(buf);
+	return 1;
 }
 
-static struct myproc *machine_proc_new(pid_t pid)
+void machine_update_detail(struct myproc *p)
 {
-	struct myproc *this = NULL;
-	char cmdln[32];
-	struct stat st;
+	struct detail *d = NULL;
+	size_t i;
+
+	/* find p, dropping anyone not on show for a while */
+	for(i = 0; i < ndetails; ){
+		struct detail *e = &details[i];
+
+		if(e->id.pid == p->pid && e->id.starttime == p->starttime){
+			d = e;
+			i++;
+		}else if(sample_us - e->read > 2 * DETAIL_US){
+			*e = details[--ndetails];
+		}else{
+			i++;
+		}
+	}
 
-	this = umalloc(sizeof *this);
-	memset(this, 0, sizeof *this);
+	if(!d){
+		if(ndetails == details_max){
+			details_max = details_max ? details_max * 2 : 64;
+			details = urealloc(details, details_max * sizeof *details);
+		}
+		d = &details[ndetails++];
+		d->id.pid = p->pid;
+		d->id.starttime = p->starttime;
+		d->read = 0;
+	}
 
-	snprintf(cmdln, sizeof cmdln, "/proc/%d/task/%d/", pid, pid);
-	if(stat(cmdln, &st) == 0)
-		machine_update_unam_gnam(this, st.st_uid, st.st_gid);
+	if(!d->read || sample_us - d->read >= DETAIL_US){
+		d->ok = detail_read(p->pid, d);
+		d->read = sample_us;
+	}
+
+	p->mem_detail = d->ok;
+	if(d->ok){
+		p->pss  = d->pss;
+		p->uss  = d->uss;
+		p->swap = d->swap;
+	}
+}
 
+struct myproc *machine_proc_new(pid_t pid)
+{
+	struct myproc *this = NULL;
+	struct statfd *e;
+	struct stat st;
+	char c;
+	int fd;
+
+	this = proc_alloc();
 	this->pid       = pid;
 	this->ppid      = -1;
 
+	/* the other table's descriptor will do, if its process is still about */
+	if((e = statfd_find(pid)) && pread(e->fd, &c, 1, 0) != 1){
+		fd_close(e);
+		e = NULL;
+	}
+
+	/* the stat file's owner is the process's */
+	if((fd = e ? e->fd : procfs_open(pid, "stat")) != -1){
+		if(fstat(fd, &st) == 0)
+			machine_update_unam_gnam(this, st.st_uid, st.st_gid);
+
+		if(!e && !fd_keep(pid, fd))
+			close(fd);
+	}
+
 	return this;
 }
 
-void machine_proc_get_more(struct myproc **procs)
+void machine_proc_free(struct myproc *p)
 {
-	/* TODO: kernel threads */
-	DIR *d = opendir("/proc");
-	struct dirent *ent;
+	/* its stat descriptor may be the other table's too - see fd_update */
+	(void)p;
+}
 
-	if(!d){
-		perror("opendir()");
-		exit(1);
+static void pids_push(pid_t **pids, size_t *n, size_t *max, pid_t pid)
+{
+	if(*n == *max){
+		*max = *max ? *max * 2 : 1024;
+		*pids = urealloc(*pids, *max * sizeof **pids);
 	}
+	(*pids)[(*n)++] = pid;
+}
+
+/* the numeric entries of d, into *pids. errno is left set on failure */
+static size_t dir_pids(DIR *d, pid_t **pids, size_t *max)
+{
+	struct dirent *ent;
+	size_t n = 0;
 
 	while((errno = 0, ent = readdir(d))){
-		int pid;
+		const char *s;
+		pid_t pid = 0;
 
-		if(sscanf(ent->d_name, "%d", &pid) == 1
-				&& !proc_get(procs, pid)){
-			struct myproc *p = machine_proc_new(pid);
+		for(s = ent->d_name; '0' <= *s && *s <= '9'; s++)
+			pid = pid * 10 + *s - '0';
 
-			if(p){
-				proc_addto(procs, p);
-			}
-		}
+		if(*s || s == ent->d_name)
+			continue;
+
+		pids_push(pids, &n, max, pid);
 	}
 
+	return n;
+}
+
+pid_t *machine_proc_list(size_t *pn)
+{
+	/* TODO: kernel threads */
+	static pid_t *pids;
+	static size_t max;
+	size_t n;
+
+	procfs_fd();
+	rewinddir(proc_dir);
+
+	n = dir_pids(proc_dir, &pids, &max);
+
 	if(errno){
 		fprintf(stderr, "readdir(): %s\n", strerror(errno));
 		exit(1);
 	}
 
+	*pn = n;
+	return pids;
+}
+
+/* the children of each of pid's threads, onto *pids. Non-zero if pid's gone */
+static int children_read(pid_t pid, pid_t **pids, size_t *n, size_t *max)
+{
+	static pid_t *tids;
+	static size_t tids_max;
+	size_t ntids, i;
+	DIR *d;
+	int fd;
+
+	if((fd = procfs_open(pid, "task")) == -1)
+		return -1;
+	if(!(d = fdopendir(fd))){
+		close(fd);
+		return -1;
+	}
+	ntids = dir_pids(d, &tids, &tids_max);
 	closedir(d);
+
+	for(i = 0; i < ntids; i++){
+		char buf[512], path[48];
+		pid_t child = 0;
+		int digits = 0;
+		ssize_t got;
+
+		snprintf(path, sizeof path, "task/%d/children", tids[i]);
+		if((fd = procfs_open(pid, path)) == -1)
+			continue; /* the thread's gone */
+
+		/* "pid pid ... ", as long as it likes */
+		while((got = read(fd, buf, sizeof buf)) > 0){
+			ssize_t j;
+
+			for(j = 0; j < got; j++){
+				if('0' <= buf[j] && buf[j] <= '9'){
+					child = child * 10 + buf[j] - '0';
+					digits = 1;
+				}else if(digits){
+					pids_push(pids, n, max, child);
+					child = digits = 0;
+				}
+			}
+		}
+		if(digits)
+			pids_push(pids, n, max, child);
+		close(fd);
+	}
+
+	return 0;
+}
+
+pid_t *machine_proc_subtree(pid_t pid, size_t *pn)
+{
+	static pid_t *pids;
+	static size_t max;
+	static int have_children = -1;
+	size_t n, i;
+
+	/* only there with CONFIG_PROC_CHILDREN */
+	if(have_children == -1){
+		char path[48];
+
+		snprintf(path, sizeof path, "%d/task/%d/children", getpid(), getpid());
+		have_children = faccessat(procfs_fd(), path, R_OK, 0) == 0;
+	}
+	if(!have_children)
+		return NULL;
+
+	n = 0;
+	pids_push(&pids, &n, &max, pid);
+
+	/* breadth first, pids[] being its own queue */
+	for(i = 0; i < n; i++)
+		if(children_read(pids[i], &pids, &n, &max) && i == 0)
+			return NULL;
+
+	*pn = n;
+	return pids;
+}
+
+pid_t *machine_thread_list(pid_t pid, size_t *pn)
+{
+	static pid_t *tids;
+	static size_t max;
+	DIR *d;
+	int fd;
+
+	if((fd = procfs_open(pid, "task")) == -1)
+		return NULL;
+	if(!(d = fdopendir(fd))){
+		close(fd);
+		return NULL;
+	}
+
+	/* a process exiting under us leaves a short list - fine */
+	*pn = dir_pids(d, &tids, &max);
+	closedir(d);
+
+	return tids;
+}
+
+struct myproc *machine_thread_new(struct myproc *proc, pid_t tid)
+{
+	struct myproc *this = proc_alloc();
+
+	this->pid  = tid;
+	this->ppid = proc->pid;
+	this->is_thread = 1;
+
+	/* threads can't have their own, as far as we're concerned */
+	this->uid  = proc->uid;
+	this->gid  = proc->gid;
+	this->unam = ustrdup(proc->unam);
+	this->gnam = ustrdup(proc->gnam);
+
+	return this;
+}
+
+int machine_update_thread(struct myproc *thread)
+{
+	char buf[STAT_BUF], path[32];
+	struct stat_line st;
+	ssize_t n = -1;
+	int fd, reread_argv;
+
+	snprintf(path, sizeof path, "task/%d/stat", thread->pid);
+	if((fd = procfs_open(thread->ppid, path)) != -1){
+		n = read(fd, buf, sizeof buf);
+		close(fd);
+	}
+
+	if(n <= 0 || stat_parse(buf, n, &st))
+		return -1;
+
+	if(thread->argv && st.starttime != thread->starttime)
+		return MACHINE_PROC_REUSED;
+	thread->starttime = st.starttime;
+
+	thread->state    = proc_state_parse(st.state);
+	thread->nice     = st.nice;
+	thread->last_cpu = st.processor;
+	thread->memsize  = st.rss > 0 ? st.rss * page_kb : 0;
+	proc_cpu(thread, st.utime + st.stime);
+	thread->utime    = st.utime;
+	thread->stime    = st.stime;
+
+	/* a thread's only name is its comm */
+	reread_argv = argv_wanted(thread, st.comm);
+	memcpy(thread->comm, st.comm, sizeof thread->comm);
+	if(reread_argv){
+		proc_set_argv(thread, thread->comm, strlen(thread->comm));
+		thread->argv_stale = 0;
+	}
+
+	return 0;
 }
 
 const char *machine_format_memory(struct sysinfo *info)
@@ -372,8 +1261,16 @@ const char *machine_format_memory(struct sysinfo *info)
 
 const char *machine_format_cpu_pct(struct sysinfo *info)
 {
-	(void)info;
-	return "todo: linux cpu pct";
+	static char buf[128];
+	char *p = buf;
+	size_t i;
+
+	for(i = 0; i < CPU_NSTATES; i++)
+		p += snprintf(p, sizeof buf - (p - buf), "%s%s %d.%d%%",
+				i ? ", " : "", cpunames[i],
+				info->cpu_states[i] / 10, info->cpu_states[i] % 10);
+
+	return buf;
 }
 
 const char *machine_proc_display_line(struct myproc *p)
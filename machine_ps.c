@@ -88,25 +88,20 @@ static const char *ps_find(pid_t search_pid)
 	return NULL;
 }
 
-static char **ps_parse_argv(char *cmd, size_t *pargc)
+static void ps_parse_argv(struct myproc *p, char *cmd)
 {
-	char **argv = NULL;
-	int argc = 0;
+	/* split on whitespace, into nul-separated arguments - in place, as
+	 * each only moves down over the gaps before it, never past strtok() */
+	size_t len = 0;
 
 	for(char *s = strtok(cmd, " \t"); s; s = strtok(NULL, " \t")){
-		argv = urealloc(argv, (++argc + 1) * sizeof *argv);
-		argv[argc - 1] = ustrdup(s);
-	}
-
-	argv[argc] = NULL;
+		size_t n = strlen(s) + 1;
 
-	*pargc = argc;
-	return argv;
-}
+		memmove(cmd + len, s, n);
+		len += n;
+	}
 
-int machine_proc_exists(struct myproc *p)
-{
-	return !!ps_find(p->pid);
+	proc_set_argv(p, cmd, len);
 }
 
 int machine_update_proc(struct myproc *p)
@@ -125,14 +120,11 @@ int machine_update_proc(struct myproc *p)
 				&pid, &ppid, &uid, &gid,
 				stat, &nice, tty, cmd) == 8)
 	{
+		p->ppid = ppid;
 		p->uid = uid;
 		p->gid = gid;
 
-		argv_free(p->argc, p->argv);
-		p->argv = ps_parse_argv(cmd, &p->argc);
-
-		char *slash = strrchr(p->argv[0], '/');
-		p->argv0_basename = slash ? slash + 1 : p->argv[0];
+		ps_parse_argv(p, cmd);
 
 		if(!p->tty || strcmp(p->tty, tty))
 			free(p->tty), p->tty = ustrdup(tty);
@@ -154,35 +146,87 @@ int machine_update_proc(struct myproc *p)
 	return -1;
 }
 
-void machine_proc_get_more(struct myproc **procs)
+pid_t *machine_proc_list(size_t *pn)
 {
+	static pid_t *pids;
+	size_t n = 0;
+
 	ps_update();
 
-	if(!ps_list)
-		return;
+	pids = urealloc(pids, (ps_n ? ps_n : 1) * sizeof *pids);
 
-	for(size_t i = 0; i < ps_n; i++){
-		pid_t pid, ppid;
+	for(size_t i = 0; ps_list && i < ps_n; i++){
+		pid_t pid;
+
+		if(sscanf(ps_list[i], " %d ", &pid) == 1)
+			pids[n++] = pid;
+	}
 
-		if(sscanf(ps_list[i], " %d %d ", &pid, &ppid) == 2
-		&& !proc_get(procs, pid))
-		{
-			struct myproc *p = umalloc(sizeof *p);
+	*pn = n;
+	return pids;
+}
 
-			/* bare minimum - rest is done in _update */
-			p->pid  = pid;
-			p->ppid = ppid;
+struct myproc *machine_proc_new(pid_t pid)
+{
+	struct myproc *p = proc_alloc();
 
-			proc_addto(procs, p);
-			machine_update_proc(p);
-		}else{
-			//fprintf(stderr, "couldn't sscanf(\"%s\")\n", ps[i]);
-		}
-	}
+	/* bare minimum - rest is done in _update */
+	p->pid  = pid;
+	p->ppid = -1;
+
+	return p;
+}
+
+void machine_update_batch(struct myproc **procs, size_t n)
+{
+	(void)procs;
+	(void)n;
+}
+
+void machine_update_detail(struct myproc *p)
+{
+	(void)p;
+}
+
+pid_t *machine_proc_subtree(pid_t pid, size_t *n)
+{
+	(void)pid;
+	(void)n;
+	return NULL;
+}
+
+pid_t *machine_thread_list(pid_t pid, size_t *n)
+{
+	(void)pid;
+	(void)n;
+	return NULL;
+}
+
+struct myproc *machine_thread_new(struct myproc *proc, pid_t tid)
+{
+	(void)proc;
+	(void)tid;
+	return NULL;
+}
+
+int machine_update_thread(struct myproc *thread)
+{
+	(void)thread;
+	return -1;
+}
+
+void machine_proc_free(struct myproc *p)
+{
+	(void)p;
 }
 
 /* TODO */
 void machine_init(struct sysinfo *info)
+{
+	machine_info_init(info);
+}
+
+void machine_info_init(struct sysinfo *info)
 {
 	memset(info, 0, sizeof *info);
 }
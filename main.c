@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/select.h>
 #include <sys/types.h>
 #include <signal.h>
@@ -11,6 +12,8 @@
 #include "gui.h"
 #include "util.h"
 #include "machine.h"
+#include "pool.h"
+#include "batch.h"
 #include "main.h"
 
 struct globals globals;
@@ -18,7 +21,7 @@ struct globals globals;
 int max_unam_len, max_gnam_len;
 int ps_from_file;
 
-static struct myproc **proclist;
+static int batch;
 
 static void extra_init()
 {
@@ -29,17 +32,34 @@ static void extra_init()
 	max_gnam_len = longest_passwd_line("/etc/group");
 }
 
+/* a positive thread count, or 0 */
+static int jobs_parse(const char *s)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	if(end == s || *end || n < 1 || n > INT_MAX)
+		return 0;
+	return n;
+}
+
 static void signal_handler(int sig)
 {
-	gui_term();
+	if(!batch)
+		gui_term();
 	fprintf(stderr, "Caught signal %d. Bye!\n", sig);
 	exit(EXIT_FAILURE);
 }
 
 int main(int argc, char **argv)
 {
+	enum batch_format batch_fmt = BATCH_TEXT;
+	long batch_period = 1000, batch_count = 0;
+	int batch_changed = 0;
 	int i;
 
+	globals.jobs = 1;
+
 	signal(SIGINT,  signal_handler);
 	signal(SIGTERM, signal_handler);
 
@@ -52,6 +72,20 @@ int main(int argc, char **argv)
 			globals.basename = 1;
 		}else if(!strcmp(argv[i], "-k")){
 			globals.kernel = 1;
+		}else if(!strcmp(argv[i], "-j") && i + 1 < argc && (globals.jobs = jobs_parse(argv[i + 1]))){
+			i++;
+		}else if(!strcmp(argv[i], "-x")){
+			globals.io = 1;
+		}else if(!strcmp(argv[i], "-B")){
+			batch = 1;
+		}else if(!strcmp(argv[i], "-o") && i + 1 < argc && !batch_format_parse(argv[i + 1], &batch_fmt)){
+			i++;
+		}else if(!strcmp(argv[i], "-i") && i + 1 < argc && (batch_period = atol(argv[i + 1])) > 0){
+			i++;
+		}else if(!strcmp(argv[i], "-n") && i + 1 < argc){
+			batch_count = atol(argv[++i]);
+		}else if(!strcmp(argv[i], "-c")){
+			batch_changed = 1;
 		}else if(!strcmp(argv[i], "-P")){
 			ps_from_file ^= 1;
 		}else if(!strcmp(argv[i], "-v")){
@@ -59,26 +93,39 @@ int main(int argc, char **argv)
 			return 0;
 		}else{
 			fprintf(stderr,
-							"Usage: %s [-f] [-d] [-P]\n"
+							"Usage: %s [-f] [-d] [-b] [-k] [-j threads] [-x] [-P]\n"
+							"       %s -B [-o text|csv|json] [-i ms] [-n count] [-c] [-k] [-j threads] [-x]\n"
 							" -f: Don't prompt for lsof and strace\n"
 							" -d: Debug mode\n"
 							" -b: Only show program basenames\n"
 							" -k: Show kernel threads\n"
+							" -j: Read processes with this many threads (default 1)\n"
+							" -x: Read and show I/O rates\n"
 							" -P: Read ps listing from ./__ps\n"
-							, *argv);
+							" -B: Write snapshots to stdout, without the gui\n"
+							" -o: Batch output format (default text)\n"
+							" -i: Batch interval in milliseconds (default 1000)\n"
+							" -n: Stop after this many snapshots (default 0, never)\n"
+							" -c: Only write new, changed and exited processes\n"
+							, *argv, *argv);
 			return 1;
 		}
 	}
 
 	extra_init();
-	gui_init();
-
-	proclist = proc_init();
+	if(batch){
+		pool_init(globals.jobs);
+		batch_run(batch_fmt, batch_period, batch_count, batch_changed);
+	}else{
+		gui_init();
+		pool_init(globals.jobs);
 
-	gui_run(proclist);
+		gui_run();
 
-	gui_term();
+		gui_term();
+	}
 	machine_term();
+	pool_term();
 
 	return EXIT_SUCCESS;
 }
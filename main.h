@@ -10,6 +10,8 @@ extern struct globals
 	int debug;
 	int kernel;
 	int basename;
+	int jobs;
+	int io; /* read and show I/O rates - toggled by the gui */
 } globals;
 
 extern int ps_from_file;
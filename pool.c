@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "util.h"
+
+/* indices handed out to a worker at a time */
+#define POOL_BLOCK 16
+
+/* Each run splits [0, n) into one range per worker. Workers eat their
+ * own range from the front, a block at a time, then steal the back half
+ * of someone else's. A range is a single word - lo << 32 | hi - so both
+ * are one compare-and-swap.
+ */
+#define RANGE(lo, hi) ((unsigned long long)(lo) << 32 | (hi))
+#define RANGE_LO(r) ((size_t)((r) >> 32))
+#define RANGE_HI(r) ((size_t)((r) & 0xffffffff))
+
+static struct worker
+{
+	unsigned long long range;
+	pthread_t tid;
+	/* 64 bytes apart, so no two ranges share a cache line */
+	char pad[64 - sizeof(unsigned long long) - sizeof(pthread_t)];
+} *workers; /* [0] is the caller */
+static int nworkers;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned pool_gen;
+static int pool_busy, pool_quit;
+
+static void (*job_fn)(size_t, void *);
+static void *job_ctx;
+
+static int range_cas(struct worker *w, unsigned long long *old, unsigned long long new)
+{
+	return __atomic_compare_exchange_n(&w->range, old, new, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static int range_take(struct worker *w, size_t *plo, size_t *phi)
+{
+	unsigned long long r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+	for(;;){
+		const size_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+		size_t k;
+
+		if(lo >= hi)
+			return 0;
+
+		k = hi - lo < POOL_BLOCK ? hi - lo : POOL_BLOCK;
+		if(range_cas(w, &r, RANGE(lo + k, hi))){
+			*plo = lo;
+			*phi = lo + k;
+			return 1;
+		}
+	}
+}
+
+static int range_steal(struct worker *victim, struct worker *self)
+{
+	unsigned long long r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+
+	for(;;){
+		const size_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if(lo >= hi)
+			return 0;
+
+		if(range_cas(victim, &r, RANGE(lo, mid))){
+			/* ours is empty, so no one else is touching it */
+			__atomic_store_n(&self->range, RANGE(mid, hi), __ATOMIC_RELEASE);
+			return 1;
+		}
+	}
+}
+
+static void pool_work(struct worker *self)
+{
+	const int me = self - workers;
+
+	for(;;){
+		size_t lo, hi;
+		int i;
+
+		while(range_take(self, &lo, &hi))
+			for(; lo < hi; lo++)
+				job_fn(lo, job_ctx);
+
+		for(i = 1; i < nworkers; i++)
+			if(range_steal(&workers[(me + i) % nworkers], self))
+				break;
+
+		if(i == nworkers)
+			return;
+	}
+}
+
+static void *pool_thread(void *arg)
+{
+	struct worker *self = arg;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for(;;){
+		while(seen == pool_gen)
+			pthread_cond_wait(&pool_go, &pool_lock);
+		seen = pool_gen;
+
+		if(pool_quit)
+			break;
+
+		pthread_mutex_unlock(&pool_lock);
+		pool_work(self);
+		pthread_mutex_lock(&pool_lock);
+
+		if(--pool_busy == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	return NULL;
+}
+
+void pool_init(int nthreads)
+{
+	int i;
+
+	if(nthreads < 1)
+		nthreads = 1;
+
+	workers = umalloc(nthreads * sizeof *workers);
+	nworkers = nthreads;
+	/* after a pool_term() */
+	pool_quit = 0;
+
+	for(i = 1; i < nworkers; i++){
+		if(pthread_create(&workers[i].tid, NULL, pool_thread, &workers[i])){
+			perror("pthread_create()");
+			nworkers = i;
+			break;
+		}
+	}
+}
+
+void pool_term(void)
+{
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	pool_quit = 1;
+	pool_gen++;
+	pthread_cond_broadcast(&pool_go);
+	pthread_mutex_unlock(&pool_lock);
+
+	for(i = 1; i < nworkers; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+}
+
+int pool_size(void)
+{
+	return nworkers;
+}
+
+void pool_run(size_t n, void (*fn)(size_t, void *), void *ctx)
+{
+	size_t i;
+	int w;
+
+	if(nworkers <= 1 || n <= POOL_BLOCK){
+		for(i = 0; i < n; i++)
+			fn(i, ctx);
+		return;
+	}
+
+	for(w = 0; w < nworkers; w++)
+		workers[w].range = RANGE(n * w / nworkers, n * (w + 1) / nworkers);
+
+	pthread_mutex_lock(&pool_lock);
+	job_fn = fn;
+	job_ctx = ctx;
+	pool_busy = nworkers - 1;
+	pool_gen++;
+	pthread_cond_broadcast(&pool_go);
+	pthread_mutex_unlock(&pool_lock);
+
+	pool_work(&workers[0]);
+
+	pthread_mutex_lock(&pool_lock);
+	while(pool_busy)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,12 @@
+#ifndef POOL_H
+#define POOL_H
+
+void pool_init(int nthreads);
+void pool_term(void);
+int  pool_size(void);
+
+void pool_run(size_t n, void (*fn)(size_t i, void *ctx), void *ctx);
+/* fn(i, ctx) for every i in [0, n), spread over the pool - the caller
+ * works too, and it returns once all are done */
+
+#endif
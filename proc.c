@@ -13,138 +13,394 @@
 
 #define PROC_IS_KERNEL(p) ((p)->ppid == 0 || (p)->ppid == 2)
 
-#define ITER_PROCS(i, p, ps)                    \
-	for(i = 0; i < HASH_TABLE_SIZE; i++)          \
-		for(p = ps[i]; p; p = p->hash_next)
+#define PROC_INDEX_MIN 256
+
+/* Processes are saved into an open-addressed table, keyed on the pid
+ * and probed linearly. pids are handed out sequentially, so the pid
+ * itself is a good enough hash, and walking the slots visits processes
+ * in (roughly) pid order:
+
+ [   0] = NULL,
+ [   1] = { "init", 1 },
+ [   2] = { "kthreadd", 2 },
+ [   3] = TOMB,             <- freed, probes continue past it
+ [   4] = { "vim", 4 },
+ [   5] = { "xterm", 260 }, <- 260 & 255 == 4, taken - probed onwards
+ ...
+ [mask] = NULL,
 
-/* Processes are saved into a hash table with size HASH_TABLE_SIZE and
- * key pid % HASH_TABLE_SIZE. If the key already exists, the new
- * element is appended to the last one throught hash_next:
+ * Removal leaves a tombstone, so freeing the current process from
+ * inside ITER_PROCS is fine. Adding may rehash the table, so it isn't.
+ */
 
- [     0] = { NULL },
- [     1] = { { "vim", 4321 }, NULL },
- [     2] = { { "sh",  9821 }, { "xterm", 9801 }, NULL }
- ...
- [NPROCS] = { NULL },
+static struct myproc proc_tomb;
 
-*/
+static struct slab proc_slab = {
+	.objsz = sizeof(struct myproc),
+	.per_chunk = 256,
+};
+#define PROC_TOMB (&proc_tomb)
 
-static void proc_add_child(struct myproc *parent, struct myproc *child)
+#define ITER_PROCS(i, p, ps)                           \
+	for(i = 0; i < (ps)->nslots; i++)                    \
+		if(!((p) = (ps)->slots[i]) || (p) == PROC_TOMB); \
+		else
+
+static size_t proc_slot(struct proctable *procs, pid_t pid)
 {
-	size_t n = 0;
-	struct myproc **i;
+	return (size_t)pid & (procs->nslots - 1);
+}
+
+static void proc_index_resize(struct proctable *procs)
+{
+	struct myproc **old = procs->slots;
+	const size_t nold = procs->nslots;
+	size_t n, i;
+
+	for(n = PROC_INDEX_MIN; n < procs->count * 4; n <<= 1);
 
-	for(i = parent->children; i && *i; i++, n++);
+	procs->slots  = umalloc(n * sizeof *procs->slots);
+	procs->nslots = n;
+	procs->ntombs = 0;
 
-	n++; /* new */
+	for(i = 0; i < nold; i++){
+		struct myproc *p = old[i];
+		size_t slot;
 
-	parent->children = urealloc(parent->children, (n + 1) * sizeof *parent->children);
-	parent->children[n - 1] = child;
-	parent->children[n]     = NULL;
+		if(!p || p == PROC_TOMB)
+			continue;
+
+		for(slot = proc_slot(procs, p->pid);
+				procs->slots[slot];
+				slot = (slot + 1) & (n - 1));
+
+		procs->slots[slot] = p;
+	}
+
+	free(old);
+}
+
+static void proc_index_del(struct proctable *procs, struct myproc *p)
+{
+	size_t slot;
+
+	for(slot = proc_slot(procs, p->pid);
+			procs->slots[slot];
+			slot = (slot + 1) & (procs->nslots - 1))
+	{
+		if(procs->slots[slot] == p){
+			procs->slots[slot] = PROC_TOMB;
+			procs->count--;
+			procs->ntombs++;
+			return;
+		}
+	}
+}
+
+/* Children hang off their parent as an intrusive, doubly linked list
+ * (in the order they were found), so adding and removing are O(1). */
+static void proc_insert_child(struct myproc *parent, struct myproc *child, struct myproc *before)
+{
+	child->parent = parent;
+	child->prev_sibling = before ? before->prev_sibling : parent->last_child;
+	child->next_sibling = before;
+
+	if(child->prev_sibling)
+		child->prev_sibling->next_sibling = child;
+	else
+		parent->first_child = child;
+
+	if(before)
+		before->prev_sibling = child;
+	else
+		parent->last_child = child;
+}
+
+static void proc_add_child(struct myproc *parent, struct myproc *child)
+{
+	proc_insert_child(parent, child, NULL);
 }
 
 static void proc_rm_child(struct myproc *parent, struct myproc *p)
 {
-	size_t n, idx, found;
-	struct myproc **pi;
+	if(p->prev_sibling)
+		p->prev_sibling->next_sibling = p->next_sibling;
+	else
+		parent->first_child = p->next_sibling;
+
+	if(p->next_sibling)
+		p->next_sibling->prev_sibling = p->prev_sibling;
+	else
+		parent->last_child = p->prev_sibling;
+
+	p->parent = NULL;
+	p->prev_sibling = p->next_sibling = NULL;
+}
+
+/* Processes without a parent in the table are the tree roots, kept in
+ * pid order (through their sibling links) on one of two lists - kernel
+ * threads (under kthreadd) are rooted separately, so hiding them is just
+ * a matter of not walking procs->kroots.
+ */
+static int proc_is_kernel_root(struct myproc *p)
+{
+	return PROC_IS_KERNEL(p) && p->pid != 1;
+}
+
+static void proc_root_add(struct proctable *procs, struct myproc *p)
+{
+	struct myproc **head = proc_is_kernel_root(p) ? &procs->kroots : &procs->roots;
+	struct myproc *prev = NULL, *i;
 
-	n = idx = found = 0;
+	procs->rows_dirty = 1;
 
-	for(pi = parent->children; pi && *pi; pi++, n++)
-		if(*pi == p)
-			found = 1;
-		else if(!found)
-			idx++;
+	for(i = *head; i && i->pid < p->pid; i = i->next_sibling)
+		prev = i;
 
-	if(!found)
+	p->prev_sibling = prev;
+	p->next_sibling = i;
+	if(i)
+		i->prev_sibling = p;
+	if(prev)
+		prev->next_sibling = p;
+	else
+		*head = p;
+}
+
+static void proc_root_rm(struct proctable *procs, struct myproc *p)
+{
+	if(p->prev_sibling)
+		p->prev_sibling->next_sibling = p->next_sibling;
+	else if(procs->roots == p)
+		procs->roots = p->next_sibling;
+	else if(procs->kroots == p)
+		procs->kroots = p->next_sibling;
+
+	if(p->next_sibling)
+		p->next_sibling->prev_sibling = p->prev_sibling;
+
+	p->prev_sibling = p->next_sibling = NULL;
+}
+
+/* Each process's tree sums are its own figures plus its children's sums.
+ * Rather than walking the tree for them, a change is carried up through
+ * the ancestors - a process's own figures as they move, and its whole
+ * subtree as it's linked in or out.
+ */
+static const struct proc_agg agg_none;
+
+static void proc_agg_move(struct myproc *from, const struct proc_agg *sub, const struct proc_agg *add)
+{
+	/* unsigned, so taking off first is fine */
+	for(struct myproc *p = from; p; p = p->parent){
+		p->tree.count = p->tree.count - sub->count + add->count;
+		p->tree.cpu   = p->tree.cpu   - sub->cpu   + add->cpu;
+		p->tree.rss   = p->tree.rss   - sub->rss   + add->rss;
+		p->tree.read  = p->tree.read  - sub->read  + add->read;
+		p->tree.write = p->tree.write - sub->write + add->write;
+	}
+}
+
+static void proc_agg_update(struct myproc *p)
+{
+	struct proc_agg own = agg_none;
+
+	own.count = 1;
+	own.cpu = p->pc_cpu > 0 ? p->pc_cpu * 100 + 0.5 : 0;
+	own.rss = p->memsize;
+	if(p->io_known){
+		own.read  = p->read_rate;
+		own.write = p->write_rate;
+	}
+
+	/* most don't move from one update to the next */
+	if(!memcmp(&own, &p->own, sizeof own))
 		return;
 
-	if(n <= 1){
-		free(parent->children);
-		parent->children = NULL;
-	}else{
-		n--; /* gone */
+	proc_agg_move(p, &p->own, &own);
+	p->own = own;
+}
 
-		/*memmove(parent->children + idx,
-		parent->children + idx + 1,
-		n * sizeof *parent->children);*/
-		size_t i;
-		for(i = idx; i < n; i++)
-			parent->children[i] = parent->children[i + 1];
+static void proc_unlink(struct proctable *procs, struct myproc *p)
+{
+	procs->rows_dirty = 1;
 
-		parent->children = urealloc(parent->children, (n + 1) * sizeof *parent->children);
-		parent->children[n] = NULL;
+	if(p->parent){
+		proc_agg_move(p->parent, &p->tree, &agg_none);
+		proc_rm_child(p->parent, p);
+	}else{
+		proc_root_rm(procs, p);
 	}
 }
 
-static void proc_free(struct myproc *p, struct myproc **procs)
+/* hang p off its parent, or make it a root if we don't have one */
+static void proc_link(struct proctable *procs, struct myproc *p)
 {
-	struct myproc *i = proc_get(procs, p->ppid);
+	struct myproc *parent = proc_get(procs, p->ppid);
 
-	/* remove parent references */
-	if(i)
-		proc_rm_child(i, p);
+	/* pid reuse can briefly make a process its own ancestor */
+	for(struct myproc *i = parent; i; i = i->parent)
+		if(i == p){
+			parent = NULL;
+			break;
+		}
 
-	/* remove hash-table references */
+	procs->rows_dirty = 1;
 
-	i = procs[p->pid % HASH_TABLE_SIZE];
-	if(i == p){
-		procs[p->pid % HASH_TABLE_SIZE] = p->hash_next;
+	if(parent){
+		proc_add_child(parent, p);
+		proc_agg_move(parent, &agg_none, &p->tree);
 	}else{
-		while(i && i->hash_next != p)
-			i = i->hash_next;
-		if(i)
-			/* i->hash_next is p, reroute */
-			i->hash_next = p->hash_next;
+		proc_root_add(procs, p);
 	}
+}
+
+static void proc_free(struct myproc *p, struct proctable *procs)
+{
+	machine_proc_free(p);
+	proc_unlink(procs, p);
+
+	/* orphans are roots until they're reparented, threads go with p */
+	for(struct myproc *c = p->first_child, *next; c; c = next){
+		next = c->next_sibling;
+		if(c->is_thread){
+			proc_free(c, procs);
+		}else{
+			c->parent = NULL;
+			proc_root_add(procs, c);
+		}
+	}
+
+	if(p->is_thread)
+		procs->nthreads--;
+	else
+		proc_index_del(procs, p);
 
 	free(p->unam);
 	free(p->gnam);
 
-	free(p->shell_cmd);
-	/*free(p->argv0_basename); - do not free*/
-	argv_free(p->argc, p->argv);
+	free(p->argv); /* and shell_cmd, argv0_basename */
 
 	free(p->tty);
 
-	free(p);
+	slab_free(&proc_slab, p);
 }
 
-struct myproc *proc_get(struct myproc **procs, pid_t pid)
+void proc_reread_argv(struct proctable *procs)
 {
 	struct myproc *p;
+	size_t i;
 
-	if(pid >= 0)
-		for(p = procs[pid % HASH_TABLE_SIZE]; p; p = p->hash_next)
-			if(p->pid == pid)
-				return p;
+	ITER_PROCS(i, p, procs)
+		p->argv_stale = 1;
+}
 
-	return NULL;
+struct myproc *proc_alloc(void)
+{
+	return slab_alloc(&proc_slab);
 }
 
-// Add a struct myproc pointer to the hash table
-void proc_addto(struct myproc **procs, struct myproc *p)
+const char *proc_alloc_str(void)
 {
-	struct myproc *last = procs[p->pid % HASH_TABLE_SIZE];
+	static char buf[64];
 
-	if(last){
-		while(last->hash_next)
-			last = last->hash_next;
-		last->hash_next = p;
-	}else{
-		procs[p->pid % HASH_TABLE_SIZE] = p;
+	/* called from the collector - format_kbytes()'s buffer is the gui's */
+	snprintf(buf, sizeof buf, "%lu/%lu procs in %lu slabs (%luK)",
+			(unsigned long)proc_slab.used,
+			(unsigned long)(proc_slab.nchunks * proc_slab.per_chunk),
+			(unsigned long)proc_slab.nchunks,
+			(unsigned long)(proc_slab.nchunks * proc_slab.per_chunk * proc_slab.objsz / 1024));
+
+	return buf;
+}
+
+struct myproc *proc_get(struct proctable *procs, pid_t pid)
+{
+	struct myproc *p;
+	size_t slot;
+
+	if(pid < 0)
+		return NULL;
+
+	for(slot = proc_slot(procs, pid);
+			(p = procs->slots[slot]);
+			slot = (slot + 1) & (procs->nslots - 1))
+	{
+		if(p != PROC_TOMB && p->pid == pid)
+			return p;
 	}
-	p->hash_next = NULL;
 
-	struct myproc *parent = proc_get(procs, p->ppid);
-	if(parent)
-		proc_add_child(parent, p);
+	return NULL;
+}
+
+// Add a struct myproc pointer to the pid index
+void proc_addto(struct proctable *procs, struct myproc *p)
+{
+	size_t slot;
+
+	/* keep the load (including tombstones) under a half */
+	if((procs->count + procs->ntombs + 1) * 2 > procs->nslots)
+		proc_index_resize(procs);
+
+	for(slot = proc_slot(procs, p->pid);
+			procs->slots[slot] && procs->slots[slot] != PROC_TOMB;
+			slot = (slot + 1) & (procs->nslots - 1));
+
+	if(procs->slots[slot] == PROC_TOMB)
+		procs->ntombs--;
+	procs->slots[slot] = p;
+	procs->count++;
+
+	/* an unknown ppid is linked in on its first update */
+	if(p->ppid != -1)
+		proc_link(procs, p);
 }
 
-// initialize hash table
-struct myproc **proc_init()
+// initialize the pid index
+struct proctable *proc_init()
 {
-	return umalloc(HASH_TABLE_SIZE * sizeof *proc_init());
+	struct proctable *procs = umalloc(sizeof *procs);
+
+	proc_index_resize(procs);
+	procs->rows_dirty = 1;
+
+	return procs;
+}
+
+struct myproc *proc_get_id(struct proctable *procs, const struct procid *id)
+{
+	struct myproc *p = proc_get(procs, id->pid);
+
+	return p && p->starttime == id->starttime ? p : NULL;
+}
+
+size_t proc_refold(struct proctable *procs, struct procid *ids, size_t n)
+{
+	struct myproc *p;
+	size_t i, j;
+	int changed = 0;
+
+	/* mark the wanted, dropping the departed... */
+	for(i = j = 0; i < n; i++){
+		if((p = proc_get_id(procs, &ids[i]))){
+			p->folded |= 2;
+			ids[j++] = ids[i];
+		}
+	}
+
+	/* ...then everyone takes on their mark */
+	ITER_PROCS(i, p, procs){
+		const int want = p->folded >> 1;
+
+		if(want != (p->folded & 1))
+			changed = 1;
+		p->folded = want;
+	}
+
+	if(changed)
+		procs->rows_dirty = 1;
+
+	return j;
 }
 
 const char *proc_state_str(struct myproc *p)
@@ -161,54 +417,103 @@ const char *proc_state_str(struct myproc *p)
 	}[p->state];
 }
 
-void proc_create_shell_cmd(struct myproc *this)
+/* argv, its strings and shell_cmd are packed into one allocation:
+ *
+ * [ argv[0] .. argv[argc] = NULL ][ "ls\0-l\0" ][ "ls -l\0" ]
+ *
+ * args holds the arguments separated (and optionally terminated) by nuls,
+ * as in /proc/$pid/cmdline.
+ */
+void proc_set_argv(struct myproc *p, const char *args, size_t len)
 {
-	char *cmd;
-	size_t cmd_len;
+	size_t argc, i, n;
+	char **argv, *strs, *cmd, *pos;
+
+	if(len && args[len - 1] == '\0')
+		len--;
+
+	for(argc = 1, i = 0; i < len; i++)
+		if(args[i] == '\0')
+			argc++;
+
+	argv = umalloc((argc + 1) * sizeof *argv + 2 * (len + 1));
+	strs = (char *)(argv + argc + 1);
+	cmd  = strs + len + 1;
+
+	memcpy(strs, args, len);
+	memcpy(cmd,  args, len);
+
+	argv[0] = strs;
+	for(i = 0, n = 1; i < len; i++)
+		if(strs[i] == '\0'){
+			argv[n++] = strs + i + 1;
+			cmd[i] = ' ';
+		}
+	/* argv[argc] and the terminators are zeroed by umalloc() */
+
+	free(p->argv);
+	p->argv      = argv;
+	p->argc      = argc;
+	p->shell_cmd = cmd;
 
-	/* recreate this->shell_cmd from argv */
-	for(size_t i = cmd_len = 0; i < this->argc; i++)
-		cmd_len += strlen(this->argv[i]) + 1;
+	if(strchr(argv[0], ':')){
+		/* sshd: ... */
+		p->argv0_basename = argv[0];
+	}else{
+		/* locate the last '/' in argv[0], which is the full command path */
+		pos = strrchr(argv[0], '/');
+		p->argv0_basename = pos ? pos + 1 : argv[0];
+	}
+}
+
+static void proc_tally(struct sysinfo *info, struct myproc *p)
+{
+	info->count++;
 
-	free(this->shell_cmd);
-	this->shell_cmd = umalloc(cmd_len + 1);
+	if(PROC_IS_KERNEL(p))
+		info->count_kernel++;
 
-	cmd = this->shell_cmd;
-	for(size_t i = 0; i < this->argc; i++)
-		cmd += sprintf(cmd, "%s ", this->argv[i]);
+	if(p->uid == globals.uid)
+		info->owned++;
+	info->procs_in_state[p->state]++;
 }
 
 static void proc_update_single(
 		struct myproc *proc,
-		struct myproc **procs,
+		struct proctable *procs,
 		struct sysinfo *info)
 {
-	if(machine_proc_exists(proc)){
-		const pid_t oldppid = proc->ppid;
-
-		machine_update_proc(proc);
+	pid_t oldppid = proc->ppid;
+	int r = machine_update_proc(proc);
 
-		info->count++;
+	if(r == MACHINE_PROC_REUSED){
+		/* same pid, different process - start afresh */
+		const pid_t pid = proc->pid;
 
-		if(PROC_IS_KERNEL(proc))
-			info->count_kernel++;
+		proc_free(proc, procs);
+		if(!(proc = machine_proc_new(pid)))
+			return;
+		proc_addto(procs, proc);
 
-		if(proc->uid == globals.uid)
-			info->owned++;
-		info->procs_in_state[proc->state]++;
+		oldppid = proc->ppid;
+		r = machine_update_proc(proc);
+	}
 
-		if(oldppid != proc->ppid){
-			struct myproc *parent = proc_get(procs, proc->ppid);
+	if(r == 0){
+		proc_tally(info, proc);
 
-			if(parent){
-				proc_add_child(parent, proc);
-			}else{
-				/* TODO: reparent to init? */
-			}
+		/* roots are relinked once their parent turns up - not every
+		 * time, as that would mark the rows dirty every update */
+		if(oldppid != proc->ppid || (!proc->parent && proc_get(procs, proc->ppid))){
+			proc_unlink(procs, proc);
+			proc_link(procs, proc);
 		}
 
-		proc_create_shell_cmd(proc);
+		/* once linked, so it reaches the right ancestors */
+		proc_agg_update(proc);
+
 	}else{
+		/* exited since we listed it */
 		proc_free(proc, procs);
 	}
 }
@@ -242,50 +547,238 @@ const char *proc_str(struct myproc *p)
 	return buf;
 }
 
-void proc_update(struct myproc **procs, struct sysinfo *info)
+static int pid_cmp(const void *a, const void *b)
+{
+	const pid_t l = *(const pid_t *)a, r = *(const pid_t *)b;
+
+	return (l > r) - (l < r);
+}
+
+static int proc_pid_cmp(const void *a, const void *b)
 {
-	int i;
+	const struct myproc *l = *(struct myproc *const *)a;
+	const struct myproc *r = *(struct myproc *const *)b;
+
+	return (l->pid > r->pid) - (l->pid < r->pid);
+}
+
+static void proc_tally_tree(struct sysinfo *info, struct myproc *p)
+{
+	proc_tally(info, p);
+
+	ITER_CHILDREN(struct myproc *, c, p)
+		if(!c->is_thread)
+			proc_tally_tree(info, c);
+}
+
+static void proc_subtree(struct myproc *p, struct myproc **out, size_t *n)
+{
+	out[(*n)++] = p;
+
+	ITER_CHILDREN(struct myproc *, c, p)
+		if(!c->is_thread)
+			proc_subtree(c, out, n);
+}
+
+void proc_update(struct proctable *procs, struct sysinfo *info)
+{
+	/* scratch, reused across updates */
+	static struct myproc **known;
+	static size_t known_max;
+	static pid_t *born;
+	static size_t born_max;
+
+	struct myproc *p, *head;
+	size_t nknown, nlive, nborn, nsurv, i, j;
+	pid_t *live = NULL;
+	int everything;
 
 	info->count = info->count_kernel = info->owned = 0;
 	memset(info->procs_in_state, 0, sizeof info->procs_in_state);
 
-	for(i = 0; i < HASH_TABLE_SIZE; i++){
-		struct myproc **change_me;
-		struct myproc *p;
+	/* when zoomed, only the head's subtree is read - listed on its own if
+	 * the backend can, otherwise picked out of everything */
+	head = procs->zoomed ? proc_get_id(procs, &procs->zoom) : NULL;
+	if(head)
+		live = machine_proc_subtree(head->pid, &nlive);
+	everything = !live;
+
+	/* one listing per update... */
+	if(!live)
+		live = machine_proc_list(&nlive);
+	qsort(live, nlive, sizeof *live, pid_cmp);
+
+	if(known_max < procs->count + nlive){
+		known_max = procs->count + nlive;
+		known = urealloc(known, known_max * sizeof *known);
+	}
+	if(born_max < nlive){
+		born_max = nlive;
+		born = urealloc(born, born_max * sizeof *born);
+	}
 
-		change_me = &procs[i];
-
-		for(p = procs[i]; p; ){
-			if(p){
-				if(!machine_proc_exists(p)){
-					/* dead */
-					struct myproc *next = p->hash_next;
-					*change_me = next;
-					proc_free(p, procs);
-					p = next;
-				}else{
-					proc_update_single(p, procs, info);
-
-					change_me = &p->hash_next;
-					p = p->hash_next;
-				}
+	nknown = 0;
+	if(head){
+		proc_subtree(head, known, &nknown);
+	}else{
+		ITER_PROCS(i, p, procs)
+			known[nknown++] = p;
+	}
+	qsort(known, nknown, sizeof *known, proc_pid_cmp);
+
+	/* ...merged against what we have */
+	nborn = nsurv = 0;
+	for(i = j = 0; i < nknown || j < nlive; ){
+		if(j == nlive || (i < nknown && known[i]->pid < live[j])){
+			if(everything){
+				/* gone */
+				proc_free(known[i++], procs);
+			}else{
+				/* left the subtree, or exited - re-reading tells which */
+				known[nsurv++] = known[i++];
 			}
+
+		}else if(i == nknown || live[j] < known[i]->pid){
+			/* new - or when zoomed, perhaps just new to the subtree. A
+			 * process reparented as the subtree was walked is seen twice */
+			if((!j || live[j] != live[j - 1])
+			&& (!head || !everything || !proc_get(procs, live[j])))
+				born[nborn++] = live[j];
+			j++;
+
+		}else{
+			/* still about, compacted to the front of known[] */
+			known[nsurv++] = known[i++];
+			j++;
+		}
+	}
+
+	/* add all the new ones before updating, so parents can be found */
+	for(i = 0; i < nborn; i++){
+		if((p = proc_get(procs, born[i]))){
+			/* had it, outside the zoomed subtree */
+			known[nsurv++] = p;
+		}else if((p = machine_proc_new(born[i]))){
+			proc_addto(procs, p);
+			known[nsurv++] = p;
 		}
 	}
 
-	machine_proc_get_more(procs);
+	machine_update_batch(known, nsurv);
+	for(i = 0; i < nsurv; i++)
+		proc_update_single(known[i], procs, info);
+
+	/* the rest of the system wasn't read, so count only what's shown */
+	if(procs->zoomed){
+		info->count = info->count_kernel = info->owned = 0;
+		memset(info->procs_in_state, 0, sizeof info->procs_in_state);
+
+		if((head = proc_get_id(procs, &procs->zoom)))
+			proc_tally_tree(info, head);
+	}
+
+	/* sizes have moved */
+	if(procs->sort != PROC_SORT_PID)
+		procs->rows_dirty = 1;
+}
+
+void proc_zoom(struct proctable *procs, const struct procid *id)
+{
+	if(id){
+		if(procs->zoomed && procs->zoom.pid == id->pid && procs->zoom.starttime == id->starttime)
+			return;
+		procs->zoom = *id;
+		procs->zoomed = 1;
+	}else{
+		if(!procs->zoomed)
+			return;
+		procs->zoomed = 0;
+	}
+	procs->rows_dirty = 1;
 }
 
-void proc_dump(struct myproc **ps, FILE *f)
+static void proc_update_thread_list(struct proctable *procs, struct myproc *p)
+{
+	struct myproc *t = p->first_child, *next;
+	size_t ntids = 0, i = 0;
+	pid_t *tids = machine_thread_list(p->pid, &ntids);
+
+	if(!tids)
+		ntids = 0;
+	qsort(tids, ntids, sizeof *tids, pid_cmp);
+
+	/* both in tid order - merged as in proc_update() */
+	while(i < ntids || (t && t->is_thread)){
+		const int have = t && t->is_thread;
+
+		if(have && (i == ntids || t->pid < tids[i])){
+			/* gone */
+			next = t->next_sibling;
+			proc_free(t, procs);
+			t = next;
+
+		}else if(!have || tids[i] < t->pid){
+			/* new */
+			struct myproc *nt = machine_thread_new(p, tids[i++]);
+
+			if(!nt)
+				continue;
+			proc_insert_child(p, nt, t);
+			procs->nthreads++;
+			procs->rows_dirty = 1;
+
+			if(machine_update_thread(nt))
+				proc_free(nt, procs);
+
+		}else{
+			next = t->next_sibling;
+			i++;
+
+			/* recycled tids are picked up afresh next time */
+			if(machine_update_thread(t))
+				proc_free(t, procs);
+			t = next;
+		}
+	}
+}
+
+static void proc_free_threads(struct proctable *procs, struct myproc *p)
+{
+	while(p->first_child && p->first_child->is_thread)
+		proc_free(p->first_child, procs);
+}
+
+void proc_update_threads(struct proctable *procs, const struct procid *ids, size_t n)
+{
+	struct myproc *p;
+	size_t i;
+
+	/* mark the wanted... */
+	for(i = 0; i < n; i++)
+		if((p = proc_get_id(procs, &ids[i])))
+			p->show_threads |= 2;
+
+	/* ...then read or drop */
+	ITER_PROCS(i, p, procs){
+		p->show_threads >>= 1;
+
+		if(p->show_threads)
+			proc_update_thread_list(procs, p);
+		else if(p->first_child && p->first_child->is_thread)
+			proc_free_threads(procs, p);
+	}
+}
+
+void proc_dump(struct proctable *ps, FILE *f)
 {
 	struct myproc *p;
-	int i;
+	size_t i;
 
 	ITER_PROCS(i, p, ps)
 		fprintf(f, "%s\n", proc_str(p));
 }
 
-struct myproc *proc_find(const char *str, struct myproc **ps)
+struct myproc *proc_find(const char *str, struct proctable *ps)
 {
 	return proc_find_n(str, ps, 0);
 }
@@ -298,26 +791,24 @@ static int proc_find_match(const char *shell_cmd, const char *search_str)
 
 static struct myproc *proc_find_n_child(const char *str, struct myproc *proc, int *n)
 {
-	struct myproc **i;
-
 	if(proc->shell_cmd && proc_find_match(proc->shell_cmd, str) && --*n < 0)
 		return proc;
 
-	for(i = proc->children; i && *i; i++){
-		struct myproc *p = *i;
+	ITER_CHILDREN(struct myproc *, i, proc){
+		struct myproc *p;
 
-		if((p = proc_find_n_child(str, p, n)))
+		if((p = proc_find_n_child(str, i, n)))
 			return p;
 	}
 
 	return NULL;
 }
 
-struct myproc *proc_find_n(const char *str, struct myproc **ps, int n)
+struct myproc *proc_find_n(const char *str, struct proctable *ps, int n)
 {
 #ifdef HASH_TABLE_ORDER
 	struct myproc *p;
-	int i;
+	size_t i;
 
 	if(str)
 		ITER_PROCS(i, p, ps)
@@ -327,140 +818,251 @@ struct myproc *proc_find_n(const char *str, struct myproc **ps, int n)
 	return NULL;
 #else
 	/* search in the same order the procs are displayed */
-	// TODO: multiple parents
-	return proc_find_n_child(str, proc_first(ps), &n);
+	if(str)
+		ITER_PROC_HEADS(struct myproc *, head, ps){
+			struct myproc *p = proc_find_n_child(str, head, &n);
+
+			if(p)
+				return p;
+		}
+
+	return NULL;
 #endif
 }
 
-static int proc_to_idx_nested(
-		struct myproc *head, struct myproc *const searchee,
-		int *py, int in_fold)
+/* The visible lines are kept flattened in procs->rows[], with each
+ * process knowing its own line (or -1 if folded away/hidden). Any change
+ * to the tree marks it dirty for a rebuild on next use, folding is done
+ * in place.
+ */
+static void proc_rows_fill(struct proctable *procs, struct myproc *p, int depth, size_t *at)
 {
-	if(head == searchee)
-		return 1;
+	procs->rows[*at] = p;
+	p->row = (*at)++;
+	p->depth = depth;
 
-	if(!in_fold)
-		++*py;
+	if(!p->folded)
+		ITER_CHILDREN(struct myproc *, c, p)
+			proc_rows_fill(procs, c, depth + 1, at);
+}
 
-	for(struct myproc **iter = head->children;
-			iter && *iter;
-			iter++)
-	{
-		if(searchee == *iter)
-			return 1;
+static int proc_mem_cmp(const void *a, const void *b)
+{
+	const struct myproc *l = *(struct myproc *const *)a;
+	const struct myproc *r = *(struct myproc *const *)b;
 
-		if(proc_to_idx_nested(*iter, searchee, py, in_fold || head->folded))
-			return 1;
-	}
+	/* largest first, ties by pid so they hold still */
+	if(l->memsize != r->memsize)
+		return l->memsize < r->memsize ? 1 : -1;
+	return (l->pid > r->pid) - (l->pid < r->pid);
+}
+
+/* As proc_rows_fill(), for the siblings in procs->sorted[from, to), put
+ * in order first. Each level's children are gathered after its siblings,
+ * so the scratch never holds more than every process */
+static void proc_rows_fill_sorted(
+		struct proctable *procs, size_t from, size_t to, int depth, size_t *at)
+{
+	size_t i;
+
+	qsort(procs->sorted + from, to - from, sizeof *procs->sorted, proc_mem_cmp);
+
+	for(i = from; i < to; i++){
+		struct myproc *const p = procs->sorted[i];
+		size_t end = to;
+
+		procs->rows[*at] = p;
+		p->row = (*at)++;
+		p->depth = depth;
 
-	return 0;
+		if(!p->folded){
+			ITER_CHILDREN(struct myproc *, c, p)
+				procs->sorted[end++] = c;
+			proc_rows_fill_sorted(procs, to, end, depth + 1, at);
+		}
+	}
 }
 
-int proc_to_idx(struct myproc **procs, struct myproc *searchee, int *py)
+static void proc_sorted_reserve(struct proctable *procs)
 {
-	ITER_PROC_HEADS(struct myproc *, head, procs)
-		if(proc_to_idx_nested(head, searchee, py, head->folded))
-			return 1;
+	const size_t n = procs->count + procs->nthreads;
 
-	return 0;
+	if(procs->sorted_max < n){
+		procs->sorted_max = n + n / 2;
+		procs->sorted = urealloc(procs->sorted, procs->sorted_max * sizeof *procs->sorted);
+	}
 }
 
-static struct myproc *proc_from_idx_nested(struct myproc *head, int *idx)
+static size_t proc_rows_count(struct myproc *p)
 {
-	if(*idx == 0)
-		return head;
+	size_t n = 0;
 
-	for(struct myproc **iter = head->children;
-			iter && *iter;
-			iter++)
-	{
-		if(--*idx <= 0){
-			return *iter;
-		}else if(!(*iter)->folded){
-			struct myproc *sub = proc_from_idx_nested(*iter, idx);
-			if(sub)
-				return sub;
-		}
+	if(!p->folded)
+		ITER_CHILDREN(struct myproc *, c, p)
+			n += 1 + proc_rows_count(c);
+
+	return n;
+}
+
+static void proc_rows_reserve(struct proctable *procs, size_t n)
+{
+	if(procs->rows_max < n){
+		procs->rows_max = n + n / 2;
+		procs->rows = urealloc(procs->rows, procs->rows_max * sizeof *procs->rows);
 	}
+}
 
-	return NULL;
+static void proc_rows_renumber(struct proctable *procs, size_t from)
+{
+	for(; from < procs->nrows; from++)
+		procs->rows[from]->row = from;
 }
 
-struct myproc *proc_from_idx(struct myproc **procs, int *idx)
+static void proc_rows_sync(struct proctable *procs)
 {
-	// TODO: kernel threads
+	struct myproc *p;
+	size_t i, n;
 
-	if(*idx < 0)
-		return NULL;
+	if(!procs->rows_dirty)
+		return;
 
-	ITER_PROC_HEADS(struct myproc *, head, procs){
-		struct myproc *test = proc_from_idx_nested(head, idx);
+	ITER_PROCS(i, p, procs){
+		p->row = -1;
 
-		if(test)
-			return test;
+		/* threads aren't in the index, but lead their process's children */
+		for(struct myproc *t = p->first_child; t && t->is_thread; t = t->next_sibling)
+			t->row = -1;
 	}
 
-	return NULL;
+	/* can't be more lines than processes and threads */
+	proc_rows_reserve(procs, procs->count + procs->nthreads);
+
+	n = 0;
+	if(procs->sort == PROC_SORT_PID){
+		ITER_PROC_HEADS(struct myproc *, head, procs)
+			proc_rows_fill(procs, head, 0, &n);
+	}else{
+		size_t nheads = 0;
+
+		proc_sorted_reserve(procs);
+		ITER_PROC_HEADS(struct myproc *, head, procs)
+			procs->sorted[nheads++] = head;
+		proc_rows_fill_sorted(procs, 0, nheads, 0, &n);
+	}
 
-#undef RET
+	procs->nrows = n;
+	procs->rows_dirty = 0;
 }
 
-struct myproc *proc_first(struct myproc **procs)
+void proc_fold(struct proctable *procs, struct myproc *p, int fold)
 {
-	struct myproc *p = proc_get(procs, 1); /* init */
-	int i;
+	size_t start, end;
 
-	if(p)
-		return p;
+	if(!p->folded == !fold)
+		return;
+	p->folded = fold;
 
-	/* the most parent-y */
-	ITER_PROCS(i, p, procs)
-		if(p->ppid == 0)
-			return p;
+	/* hidden lines don't move anything */
+	if(procs->rows_dirty || p->row == -1)
+		return;
 
-	ITER_PROCS(i, p, procs)
-		if(p->ppid == 1)
-			return p;
+	start = p->row + 1;
 
-	ITER_PROCS(i, p, procs)
-		if(!proc_get(procs, p->ppid))
-			return p;
+	if(fold){
+		for(end = start; end < procs->nrows && procs->rows[end]->depth > p->depth; end++)
+			procs->rows[end]->row = -1;
 
-	return NULL;
+		memmove(procs->rows + start, procs->rows + end,
+				(procs->nrows - end) * sizeof *procs->rows);
+		procs->nrows -= end - start;
+
+		proc_rows_renumber(procs, start);
+	}else{
+		const size_t n = proc_rows_count(p);
+
+		proc_rows_reserve(procs, procs->nrows + n);
+		memmove(procs->rows + start + n, procs->rows + start,
+				(procs->nrows - start) * sizeof *procs->rows);
+		procs->nrows += n;
+
+		end = start;
+		if(procs->sort == PROC_SORT_PID){
+			ITER_CHILDREN(struct myproc *, c, p)
+				proc_rows_fill(procs, c, p->depth + 1, &end);
+		}else{
+			size_t nchildren = 0;
+
+			proc_sorted_reserve(procs);
+			ITER_CHILDREN(struct myproc *, c, p)
+				procs->sorted[nchildren++] = c;
+			proc_rows_fill_sorted(procs, 0, nchildren, p->depth + 1, &end);
+		}
+
+		proc_rows_renumber(procs, end);
+	}
 }
 
-struct myproc *proc_first_next(struct myproc **procs)
+void proc_sort(struct proctable *procs, enum proc_sort sort)
 {
-	struct myproc *p;
-	int i;
+	if(procs->sort != sort){
+		procs->sort = sort;
+		procs->rows_dirty = 1;
+	}
+}
 
-	ITER_PROCS(i, p, procs)
-		if(!p->mark && !proc_get(procs, p->ppid))
-			return p;
+int proc_to_idx(struct proctable *procs, struct myproc *searchee, int *py)
+{
+	if(!searchee)
+		return 0;
 
-	ITER_PROCS(i, p, procs)
-		if(!p->mark)
-			return p;
+	proc_rows_sync(procs);
 
-	return NULL;
+	if(searchee->row == -1)
+		return 0;
+
+	*py = searchee->row;
+	return 1;
 }
 
-void proc_unmark(struct myproc **procs)
+struct myproc *proc_from_idx(struct proctable *procs, int idx)
 {
-	struct myproc *p;
-	int i;
+	proc_rows_sync(procs);
 
-	ITER_PROCS(i, p, procs)
-		/* unmark everything except those whose ppids we don't have yet */
-		p->mark = p->ppid == -1;
+	if(idx < 0 || (size_t)idx >= procs->nrows)
+		return NULL;
+
+	return procs->rows[idx];
 }
 
-void proc_mark_kernel(struct myproc **procs)
+int proc_row_count(struct proctable *procs)
 {
-	struct myproc *p;
-	int i;
+	proc_rows_sync(procs);
 
-	ITER_PROCS(i, p, procs)
-		if(PROC_IS_KERNEL(p))
-			p->mark = 1;
+	return procs->nrows;
+}
+
+struct myproc *proc_first(struct proctable *procs)
+{
+	if(procs->zoomed)
+		return proc_get_id(procs, &procs->zoom);
+
+	if(procs->roots)
+		return procs->roots;
+
+	return globals.kernel ? procs->kroots : NULL;
+}
+
+struct myproc *proc_next_head(struct proctable *procs, struct myproc *p)
+{
+	if(procs->zoomed)
+		return NULL;
+
+	if(p->next_sibling)
+		return p->next_sibling;
+
+	/* off the end of procs->roots, onto kernel threads if wanted */
+	if(globals.kernel && !proc_is_kernel_root(p))
+		return procs->kroots;
+
+	return NULL;
 }
@@ -2,38 +2,55 @@
 #define PROC_H
 
 struct sysinfo;
-
-struct myproc **proc_init(void);
-struct myproc  *proc_get(struct myproc **, pid_t);
-void          proc_update(struct myproc **procs, struct sysinfo *info);
-void          proc_cleanup(struct myproc **);
-void          proc_addto(struct myproc **procs, struct myproc *p);
-void          proc_create_shell_cmd(struct myproc *this);
-
-struct myproc  *proc_to_list(struct myproc **);
-struct myproc  *proc_to_tree(struct myproc **);
-struct myproc  *proc_find(  const char *, struct myproc **);
-struct myproc  *proc_find_n(const char *, struct myproc **, int);
+struct proctable;
+struct procid;
+
+struct proctable *proc_init(void);
+struct myproc  *proc_get(struct proctable *, pid_t);
+struct myproc  *proc_get_id(struct proctable *, const struct procid *);
+void          proc_update(struct proctable *procs, struct sysinfo *info);
+void          proc_cleanup(struct proctable *);
+void          proc_addto(struct proctable *procs, struct myproc *p);
+struct myproc  *proc_alloc(void);
+const char     *proc_alloc_str(void);
+void          proc_set_argv(struct myproc *p, const char *args, size_t len);
+void          proc_reread_argv(struct proctable *procs);
+
+struct myproc  *proc_to_list(struct proctable *);
+struct myproc  *proc_to_tree(struct proctable *);
+struct myproc  *proc_find(  const char *, struct proctable *);
+struct myproc  *proc_find_n(const char *, struct proctable *, int);
 const char     *proc_str(struct myproc *p);
 const char     *proc_state_str(struct myproc *p);
-int            proc_listcontains(struct myproc **procs, pid_t pid);
-int            proc_to_idx(struct myproc **procs, struct myproc *searchee, int *py);
-struct myproc  *proc_from_idx(struct myproc **procs, int *idx);
-
-struct myproc  *proc_first(     struct myproc **procs);
-struct myproc  *proc_first_next(struct myproc **procs);
-void            proc_unmark(struct myproc **procs);
-void            proc_mark_kernel(struct myproc **procs);
-
-void proc_dump(struct myproc **ps, FILE *f);
+int            proc_listcontains(struct proctable *procs, pid_t pid);
+int            proc_to_idx(struct proctable *procs, struct myproc *searchee, int *py);
+struct myproc  *proc_from_idx(struct proctable *procs, int idx);
+int            proc_row_count(struct proctable *procs);
+void           proc_fold(struct proctable *procs, struct myproc *p, int fold);
+size_t         proc_refold(struct proctable *procs, struct procid *ids, size_t n);
+/* fold exactly the processes in ids, dropping any gone from ids.
+ * Returns the number left */
+void           proc_sort(struct proctable *procs, enum proc_sort sort);
+void           proc_update_threads(struct proctable *procs, const struct procid *ids, size_t n);
+/* read the threads of exactly the processes in ids, dropping the rest */
+void           proc_zoom(struct proctable *procs, const struct procid *id);
+/* show and update only id's subtree, or everything if NULL */
+
+struct myproc  *proc_first(    struct proctable *procs);
+struct myproc  *proc_next_head(struct proctable *procs, struct myproc *p);
+
+void proc_dump(struct proctable *ps, FILE *f);
 
 enum proc_state proc_state_parse(char c);
 
-#define HASH_TABLE_SIZE 128
-
 #define ITER_PROC_HEADS(ty, p, procs)  \
 	for(ty p = proc_first(procs);        \
 			p;                               \
-			p = proc_first_next(procs))
+			p = proc_next_head(procs, p))
+
+#define ITER_CHILDREN(ty, c, p)       \
+	for(ty c = (p)->first_child;        \
+			c;                              \
+			c = c->next_sibling)
 
 #endif
@@ -3,6 +3,15 @@
 
 #include <sys/time.h>
 
+/* summed over a subtree - integers, so they come off exactly as they went on */
+struct proc_agg
+{
+	unsigned long count;
+	unsigned long cpu;               /* hundredths of a percent */
+	unsigned long long rss;          /* KB */
+	unsigned long long read, write;  /* bytes per second */
+};
+
 struct myproc
 {
 	pid_t pid, ppid;
@@ -13,10 +22,16 @@ struct myproc
 	gid_t pgrp;
 	char *unam, *gnam;
 
-	char *shell_cmd;      /* allocated, from argv */
-	char **argv;	      /* allocated */
+	char **argv;          /* allocated, see proc_set_argv() */
 	size_t argc;
+	char *shell_cmd;      /* argv, space separated - in argv's allocation */
 	char *argv0_basename; /* pointer to somewhere in argv[0] */
+	unsigned char argv_stale;
+	char comm[32];
+	unsigned char is_thread; /* a thread of ppid, see proc_update_threads() */
+
+	/* with the pid, identifies the process */
+	unsigned long long starttime;
 
 	enum proc_state
 	{
@@ -33,18 +48,32 @@ struct myproc
 
 	char *tty;
 	signed char nice;
+	int last_cpu; /* the cpu it last ran on */
 
 	unsigned char folded;
+	unsigned char show_threads;
+	int row, depth; /* line in proctable.rows, or -1 */
 
 	double pc_cpu;
 	unsigned long utime, stime, cutime, cstime;
+	/* I/O totals, and their rates per second if io_known - only read with
+	 * globals.io */
+	unsigned long long read_bytes, write_bytes, syscr, syscw;
+	double read_rate, write_rate, syscall_rate;
+	unsigned char io_known;
 	unsigned long cputime;
-	unsigned long memsize;
+	unsigned long memsize;         /* resident, KB */
+	unsigned long pss, uss, swap;  /* KB, if mem_detail, see machine_update_detail() */
+	unsigned char mem_detail;
 
 	/* important */
-	struct myproc *hash_next;
-	struct myproc **children;
-	int mark;
+	struct myproc *parent; /* NULL for roots */
+	struct myproc *first_child, *last_child;
+	struct myproc *prev_sibling, *next_sibling; /* or the next root */
+
+	/* its part of the sums, as last added, and the sums over it and its
+	 * descendants (threads add nothing) - kept up as the tree changes */
+	struct proc_agg own, tree;
 
 	union
 	{
@@ -52,9 +81,68 @@ struct myproc
 		{
 			int flag;
 		} freebsd;
+
+		struct
+		{
+			size_t batch; /* stat read ahead, index + 1, or 0 */
+			unsigned long long sampled; /* when utime/stime were read, us, or 0 */
+			unsigned long long io_sampled; /* likewise for the I/O totals */
+			unsigned char io_denied; /* someone else's - don't try again */
+		} procfs;
 	} machine;
 };
 
+/* a process, across updates - a pid alone may be reused */
+struct procid
+{
+	pid_t pid;
+	unsigned long long starttime;
+};
+
+struct proctable
+{
+	/* open-addressed pid index, see proc.c */
+	struct myproc **slots;
+	size_t nslots; /* power of two */
+	size_t count, ntombs;
+	size_t nthreads; /* records not in the index */
+
+	/* processes with no parent in the table, see proc.c */
+	struct myproc *roots, *kroots;
+
+	/* the visible tree, flattened into lines */
+	struct myproc **rows;
+	size_t nrows, rows_max;
+	int rows_dirty;
+
+	/* how siblings are ordered in rows */
+	enum proc_sort
+	{
+		PROC_SORT_PID,
+		PROC_SORT_MEM, /* largest resident first */
+	} sort;
+	struct myproc **sorted; /* scratch for the above */
+	size_t sorted_max;
+
+	/* if zoomed, the only head shown and the only subtree updated */
+	int zoomed;
+	struct procid zoom;
+};
+
+/* where cpu time goes - the order of the cpu lines in Linux's /proc/stat */
+enum cpu_state
+{
+	CPU_USER,
+	CPU_NICE,
+	CPU_SYS,
+	CPU_IDLE,
+	CPU_IOWAIT,
+	CPU_IRQ,
+	CPU_SOFTIRQ,
+	CPU_STEAL,
+#define CPU_NSTATES (CPU_STEAL + 1)
+};
+
 struct sysinfo
 {
 	// process info
@@ -74,6 +162,10 @@ struct sysinfo
 
 	unsigned long cpu_cycles;
 	int ncpus;
+	/* per mille of the last interval in each state, over all cpus and for
+	 * each of ncpus - machine_update() allocates cpu_each, all 0 if offline */
+	unsigned short cpu_states[CPU_NSTATES];
+	unsigned short (*cpu_each)[CPU_NSTATES];
 
 	struct timeval boottime;
 };
@@ -140,9 +140,8 @@ int longest_passwd_line(const char *fname)
 }
 
 
-const char *format_kbytes(long unsigned val)
+char *format_kbytes_r(long unsigned val, char *buf, size_t len)
 {
-	static char buf[64];
 	char prefix;
 
 	if(val / (1024 * 1024) > 10){
@@ -155,11 +154,18 @@ const char *format_kbytes(long unsigned val)
 		prefix = 'K';
 	}
 
-	snprintf(buf, sizeof buf, "%lu%c", val, prefix);
+	snprintf(buf, len, "%lu%c", val, prefix);
 
 	return buf;
 }
 
+const char *format_kbytes(long unsigned val)
+{
+	static char buf[64];
+
+	return format_kbytes_r(val, buf, sizeof buf);
+}
+
 const char *format_seconds(unsigned long timeval)
 {
 #define BUF_PRINTF(fmt, ...) i += snprintf(&buf[i], sizeof(buf) - i, fmt, __VA_ARGS__)
@@ -188,11 +194,38 @@ const char *format_seconds(unsigned long timeval)
 #undef BUF_PRINTF
 }
 
-void argv_free(size_t argc, char **argv)
+void *slab_alloc(struct slab *slab)
+{
+	void *p;
+
+	if(!slab->free){
+		/* carve a new chunk up onto the free list, lowest address first */
+		char *chunk = umalloc(slab->objsz * slab->per_chunk);
+		size_t i;
+
+		slab->chunks = urealloc(slab->chunks, (slab->nchunks + 1) * sizeof *slab->chunks);
+		slab->chunks[slab->nchunks++] = chunk;
+
+		for(i = slab->per_chunk; i > 0; i--){
+			void *obj = chunk + (i - 1) * slab->objsz;
+			*(void **)obj = slab->free;
+			slab->free = obj;
+		}
+	}
+
+	p = slab->free;
+	slab->free = *(void **)p;
+	slab->used++;
+
+	memset(p, 0, slab->objsz);
+	return p;
+}
+
+void slab_free(struct slab *slab, void *p)
 {
-	for(size_t i = 0; i < argc; i++)
-		free(argv[i]);
-	free(argv);
+	*(void **)p = slab->free;
+	slab->free = p;
+	slab->used--;
 }
 
 static void lc(char *p)
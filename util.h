@@ -13,9 +13,21 @@ int str_to_sig(const char *);
 int longest_passwd_line(const char *fname);
 
 const char *format_kbytes(long unsigned val);
+char *format_kbytes_r(long unsigned val, char *buf, size_t len);
 const char *format_seconds(long unsigned timeval);
 
-void argv_free(size_t argc, char **argv);
+/* fixed-size object pool, carved out of contiguous chunks */
+struct slab
+{
+	size_t objsz, per_chunk;
+	char **chunks;
+	size_t nchunks;
+	void *free; /* threaded through the free objects */
+	size_t used;
+};
+
+void *slab_alloc(struct slab *);
+void slab_free(struct slab *, void *);
 
 const char *ustrcasestr(const char *a, const char *b);
 